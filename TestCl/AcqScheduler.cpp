@@ -0,0 +1,116 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "AcqScheduler.h"
+#include "MonoClock.h"
+
+#include <math.h>
+
+CAcqScheduler::CAcqScheduler(CInterfaceObject *pObj)
+{
+	m_pObj = pObj;
+
+	m_SetupEst = 3000000;		// 3 HID round trips, refined while running
+	m_IssueEst = 200000;
+	m_SpinMargin = 200000;
+	m_Guard = 500000;
+
+	m_Chan = -1;
+}
+
+// Sleep most of the way with clock_nanosleep, then spin the last m_SpinMargin
+// to absorb scheduler wake-up latency.
+
+void CAcqScheduler::WaitUntil(uint64_t deadline)
+{
+	if (deadline > m_SpinMargin)
+		SleepUntilNs(deadline - m_SpinMargin);
+
+	while (MonoTimeNs() < deadline)
+		;
+}
+
+// The first job programs everything, as the device state is not known
+
+void CAcqScheduler::ProgramRegisters(const AcqJob &job)
+{
+	m_pObj->ApplySettings((BYTE)job.chan, job.gain, job.int_time, m_Chan < 0);
+
+	m_Chan = job.chan;
+}
+
+int CAcqScheduler::Run(const AcqJob *jobs, int n, AcqJobResult *results, AcqStats *stats, AcqFrameCallback cb, void *user)
+{
+	double sum = 0, sum2 = 0, maxabs = 0;
+	int overruns = 0, errors = 0;
+
+	m_Chan = -1;			// Device state is unknown until the first job has programmed it
+
+	for (int i = 0; i < n; i++) {
+		const AcqJob &job = jobs[i];
+		AcqJobResult res;
+
+		res.overrun = 0;
+
+		// Start programming early enough that the capture command can go out on time
+
+		uint64_t lead = m_SetupEst + m_IssueEst + m_Guard;
+		if (job.t_start > lead)
+			SleepUntilNs(job.t_start - lead);
+
+		uint64_t t0 = MonoTimeNs();
+		ProgramRegisters(job);
+		uint64_t t1 = MonoTimeNs();
+
+		uint64_t setup = t1 - t0;
+		if (setup > m_SetupEst) m_SetupEst = setup;				// Be pessimistic quickly, optimistic slowly
+		else m_SetupEst = (7 * m_SetupEst + setup) / 8;
+
+		uint64_t t_cmd = job.t_start > m_IssueEst ? job.t_start - m_IssueEst : 0;
+
+		if (t1 > t_cmd)
+			res.overrun = 1;
+		else
+			WaitUntil(t_cmd);
+
+		uint64_t t2 = MonoTimeNs();
+		m_pObj->IssueCapture12((BYTE)job.chan);
+		res.t_issue = MonoTimeNs();
+
+		uint64_t issue = res.t_issue - t2;
+		m_IssueEst = (7 * m_IssueEst + issue) / 8;
+
+		res.jitter = (int64_t)(res.t_issue - job.t_start);
+		res.error = m_pObj->ReadFrame();
+
+		if (res.overrun) overruns++;
+		if (res.error) errors++;
+
+		double j = (double)res.jitter / 1000.0;
+		sum += j;
+		sum2 += j * j;
+		if (fabs(j) > maxabs) maxabs = fabs(j);
+
+		if (results) results[i] = res;
+		if (cb) cb(i, &res, m_pObj, user);
+
+		if (res.error) {			// Device is gone, the rest of the timeline cannot run
+			n = i + 1;
+			break;
+		}
+	}
+
+	if (stats) {
+		stats->jobs = n;
+		stats->overruns = overruns;
+		stats->errors = errors;
+		stats->mean_jitter_us = n ? sum / n : 0;
+		stats->rms_jitter_us = n ? sqrt(sum2 / n) : 0;
+		stats->max_abs_jitter_us = maxabs;
+		stats->setup_lead_us = (double)GetSetupLead() / 1000.0;
+	}
+
+	return overruns;
+}
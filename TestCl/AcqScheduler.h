@@ -0,0 +1,67 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+
+#include "InterfaceObj.h"
+
+// One timed capture. Jobs are executed in array order and must be sorted by t_start.
+
+struct AcqJob {
+	int			chan;				// 1-4
+	int			gain;				// 0: high gain; 1: low gain
+	float		int_time;			// Integration time in ms
+	uint64_t	t_start;			// Integration start, MonoTimeNs() clock
+};
+
+struct AcqJobResult {
+	uint64_t	t_issue;			// Time the capture command was handed to the device
+	int64_t		jitter;				// t_issue - t_start in ns, positive is late
+	int			overrun;			// 1: the job could not be started on time
+	int			error;				// 1: capture failed
+};
+
+struct AcqStats {
+	int			jobs;
+	int			overruns;
+	int			errors;
+	double		mean_jitter_us;		// Signed mean start error
+	double		rms_jitter_us;
+	double		max_abs_jitter_us;
+	double		setup_lead_us;		// Register programming lead used at the end of the run
+};
+
+// Called after each job with the corrected frame in CInterfaceObject::frame_data
+typedef void (*AcqFrameCallback)(int job, const AcqJobResult *res, CInterfaceObject *pObj, void *user);
+
+class CAcqScheduler {
+
+protected:
+
+	CInterfaceObject *m_pObj;
+
+	uint64_t	m_SetupEst;			// Estimated register programming time, ns
+	uint64_t	m_IssueEst;			// Estimated capture command write latency, ns
+	uint64_t	m_SpinMargin;		// Busy-wait window before each command, ns
+	uint64_t	m_Guard;			// Extra slack between programming and the command, ns
+
+	int			m_Chan;				// Channel last programmed by the scheduler, -1: unknown
+
+public:
+
+	CAcqScheduler(CInterfaceObject *pObj);
+
+	void SetSpinMargin(uint64_t ns) { m_SpinMargin = ns; }
+	void SetGuard(uint64_t ns) { m_Guard = ns; }
+	uint64_t GetSetupLead() { return m_SetupEst + m_IssueEst + m_Guard; }		// How early a job's register writes begin
+
+	// Runs the timeline to completion on the calling thread. Returns number of overruns.
+	int Run(const AcqJob *jobs, int n, AcqJobResult *results, AcqStats *stats, AcqFrameCallback cb = NULL, void *user = NULL);
+
+protected:
+
+	void ProgramRegisters(const AcqJob &job);
+	void WaitUntil(uint64_t deadline);
+};
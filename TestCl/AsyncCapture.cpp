@@ -0,0 +1,272 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "AsyncCapture.h"
+
+#ifndef _WIN32
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+CAsyncCapture::CAsyncCapture(CInterfaceObject *pObj, std::recursive_mutex *pDeviceLock)
+{
+	m_pObj = pObj;
+	m_pDeviceLock = pDeviceLock;
+
+	m_NextId = 1;
+	m_Quit = false;
+
+#ifdef _WIN32
+	m_EventFd = -1;
+#else
+	m_EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+	m_Worker = std::thread(&CAsyncCapture::Run, this);
+}
+
+CAsyncCapture::~CAsyncCapture()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Quit = true;
+	}
+	m_Wake.notify_all();
+	m_Worker.join();
+
+	for (std::map<int, AsyncRequest *>::iterator it = m_Requests.begin(); it != m_Requests.end(); ++it)
+		delete it->second;
+
+#ifndef _WIN32
+	if (m_EventFd >= 0)
+		close(m_EventFd);
+#endif
+}
+
+int CAsyncCapture::Submit(int op, int chan, int ival, float fval, AsyncCallback cb, void *user)
+{
+	AsyncRequest *req = new AsyncRequest;
+
+	req->op = op;
+	req->chan = chan;
+	req->ival = ival;
+	req->fval = fval;
+	req->status = ASYNC_PENDING;
+	req->cb = cb;
+	req->user = user;
+	memset(&req->meta, 0, sizeof(req->meta));
+
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		if (m_Quit) {
+			delete req;
+			return 0;
+		}
+
+		req->id = m_NextId++;
+		if (m_NextId <= 0)
+			m_NextId = 1;
+
+		m_Requests[req->id] = req;
+		m_Queue.push_back(req);
+	}
+	m_Wake.notify_one();
+
+	return req->id;
+}
+
+int CAsyncCapture::GetStatus(int id)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	std::map<int, AsyncRequest *>::iterator it = m_Requests.find(id);
+
+	return it == m_Requests.end() ? ASYNC_UNKNOWN : it->second->status;
+}
+
+int CAsyncCapture::Collect(int id, FrameMeta *meta, int *frame)
+{
+	AsyncRequest *req;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		std::map<int, AsyncRequest *>::iterator it = m_Requests.find(id);
+		if (it == m_Requests.end())
+			return ASYNC_UNKNOWN;
+
+		req = it->second;
+		if (req->status == ASYNC_PENDING)
+			return ASYNC_PENDING;
+
+		m_Requests.erase(it);
+	}
+
+	if (meta) *meta = req->meta;
+	if (frame && req->status == ASYNC_DONE && req->meta.size)
+		memcpy(frame, req->frame, req->meta.size * req->meta.size * sizeof(int));
+
+	int status = req->status;
+	delete req;
+
+	return status;
+}
+
+int CAsyncCapture::Release(int id)
+{
+	return Collect(id, NULL, NULL) != ASYNC_UNKNOWN;
+}
+
+// The eventfd is read under m_Lock so its count and m_Completed agree. Ids
+// left over for the next call are written back, so the fd stays readable.
+
+int CAsyncCapture::PollCompleted(int *ids, int max)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+#ifndef _WIN32
+	uint64_t v;
+	if (m_EventFd >= 0) {
+		ssize_t r = read(m_EventFd, &v, sizeof(v));		// EAGAIN is fine, the queue below is authoritative
+		(void)r;
+	}
+#endif
+
+	int n = 0;
+	while (n < max && !m_Completed.empty()) {
+		ids[n++] = m_Completed.front();
+		m_Completed.pop_front();
+	}
+
+#ifndef _WIN32
+	if (m_EventFd >= 0 && !m_Completed.empty()) {
+		uint64_t left = m_Completed.size();
+		ssize_t r = write(m_EventFd, &left, sizeof(left));
+		(void)r;
+	}
+#endif
+
+	return n;
+}
+
+// Runs on the worker thread. Fills in the result; the status is published by the caller under m_Lock.
+
+int CAsyncCapture::Execute(AsyncRequest *req)
+{
+	std::lock_guard<std::recursive_mutex> lock(*m_pDeviceLock);
+
+	int e = 0;
+	bool capture = false;
+
+	switch (req->op) {
+	case ASYNC_OP_CAPTURE12:
+		e = m_pObj->CaptureFrame12((BYTE)req->chan);
+		capture = true;
+		break;
+
+	case ASYNC_OP_CAPTURE24:
+		if (req->chan != m_pObj->cur_chan)
+			m_pObj->SelSensor((BYTE)req->chan);
+		e = m_pObj->CaptureFrame24();
+		capture = true;
+		break;
+
+	case ASYNC_OP_DIFF12:
+		e = m_pObj->CaptureDiff12((BYTE)req->chan);
+		capture = true;
+		break;
+
+	case ASYNC_OP_SELCHAN:
+		m_pObj->SelSensor((BYTE)req->chan);
+		break;
+
+	case ASYNC_OP_SETGAIN:
+		m_pObj->SetGainMode(req->ival);
+		break;
+
+	case ASYNC_OP_SETINTTIME:
+		m_pObj->SetIntTime(req->fval);
+		break;
+
+	case ASYNC_OP_PREPARE:
+		m_pObj->PrepareChannel((BYTE)req->chan);
+		break;
+
+	default:
+		e = 1;
+		break;
+	}
+
+	if (!m_pObj->IsDeviceDetected())
+		e = 1;
+
+	if (capture && !e) {
+		int dim = m_pObj->frame_meta.size;
+
+		req->meta = m_pObj->frame_meta;
+		for (int i = 0; i < dim; i++)
+			memcpy(&req->frame[i * dim], m_pObj->frame_data[i], dim * sizeof(int));
+	}
+
+	return e ? ASYNC_FAILED : ASYNC_DONE;
+}
+
+void CAsyncCapture::Run()
+{
+	for (;;) {
+		AsyncRequest *req;
+
+		{
+			std::unique_lock<std::mutex> lock(m_Lock);
+
+			while (!m_Quit && m_Queue.empty())
+				m_Wake.wait(lock);
+
+			if (m_Quit)
+				break;
+
+			req = m_Queue.front();
+			m_Queue.pop_front();
+		}
+
+		int status = Execute(req);
+
+		int id;
+		AsyncCallback cb;
+		void *user;
+
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+
+			req->status = status;
+			id = req->id;
+			cb = req->cb;
+			user = req->user;
+
+			m_Completed.push_back(id);
+		}
+
+#ifndef _WIN32
+		if (m_EventFd >= 0) {
+			uint64_t one = 1;
+			ssize_t r = write(m_EventFd, &one, sizeof(one));
+			(void)r;
+		}
+#endif
+
+		if (cb)
+			cb(id, status, user);			// req may already be collected by another thread
+	}
+
+	// Whatever is still queued will never run
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	while (!m_Queue.empty()) {
+		m_Queue.front()->status = ASYNC_FAILED;
+		m_Queue.pop_front();
+	}
+}
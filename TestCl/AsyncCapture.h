@@ -0,0 +1,84 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "InterfaceObj.h"
+
+#define ASYNC_OP_CAPTURE12	1
+#define ASYNC_OP_CAPTURE24	2
+#define ASYNC_OP_DIFF12		3
+#define ASYNC_OP_SELCHAN	4
+#define ASYNC_OP_SETGAIN	5
+#define ASYNC_OP_SETINTTIME	6
+#define ASYNC_OP_PREPARE	7			// Program a channel's trim ahead of its first use
+
+#define ASYNC_PENDING		0
+#define ASYNC_DONE			1
+#define ASYNC_FAILED		-1
+#define ASYNC_UNKNOWN		-2
+
+typedef void (*AsyncCallback)(int id, int status, void *user);
+
+struct AsyncRequest {
+	int			id;
+	int			op;					// ASYNC_OP_xxx
+	int			chan;
+	int			ival;				// Gain
+	float		fval;				// Integration time
+	int			status;				// ASYNC_xxx
+	FrameMeta	meta;				// Capture ops only
+	int			frame[MAX_IMAGE_SIZE * MAX_IMAGE_SIZE];		// meta.size x meta.size row-major
+
+	AsyncCallback cb;
+	void		*user;
+};
+
+// Runs device operations on a worker thread. Submit returns at once; completion
+// is signalled through the request's callback (on the worker thread) and an
+// eventfd that becomes readable, so one event loop can drive many devices.
+// Finished requests are kept until Collect or Release.
+
+class CAsyncCapture {
+
+protected:
+
+	CInterfaceObject *m_pObj;
+	std::recursive_mutex *m_pDeviceLock;	// Shared with synchronous callers of m_pObj
+
+	std::mutex	m_Lock;
+	std::condition_variable m_Wake;
+	std::deque<AsyncRequest *> m_Queue;
+	std::map<int, AsyncRequest *> m_Requests;		// Pending and finished, by id
+	std::deque<int> m_Completed;					// Finished ids not yet reported by PollCompleted
+
+	int			m_NextId;
+	int			m_EventFd;
+	bool		m_Quit;
+
+	std::thread	m_Worker;
+
+public:
+
+	CAsyncCapture(CInterfaceObject *pObj, std::recursive_mutex *pDeviceLock);
+	~CAsyncCapture();			// Fails queued requests and joins the worker
+
+	int  Submit(int op, int chan, int ival, float fval, AsyncCallback cb, void *user);	// Returns id > 0, 0 on error
+	int  GetStatus(int id);
+	int  Collect(int id, FrameMeta *meta, int *frame);		// Copies the result and releases the request
+	int  Release(int id);
+	int  PollCompleted(int *ids, int max);					// Drains the eventfd
+	int  GetEventFd() { return m_EventFd; }					// -1 where eventfd is not available
+	bool IsWorkerThread() { return std::this_thread::get_id() == m_Worker.get_id(); }	// Called from a callback
+
+protected:
+
+	void Run();
+	int  Execute(AsyncRequest *req);
+};
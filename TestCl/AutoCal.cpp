@@ -0,0 +1,413 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "AutoCal.h"
+
+#define AUTOCAL_PASSES	3
+#define AUTOCAL_TRIM	24				// Residual (LSB) beyond which a sample is dropped after the first pass
+#define AUTOCAL_HUMP_ITERS	4			// Fixed-point steps of the hump fit, see FitKb
+
+void AutoCalDefaultPlan(AutoCalPlan *plan)
+{
+	static const float dark[] = { 1, 2, 5, 10, 20, 50 };
+
+	memset(plan, 0, sizeof(*plan));
+
+	plan->frames = 4;
+
+	plan->ndark = sizeof(dark) / sizeof(dark[0]);
+	for (int i = 0; i < plan->ndark; i++)
+		plan->dark_time[i] = dark[i];
+
+	plan->nramp = 28;					// 1 ms to 1.2 s, 30% apart
+	for (int i = 0; i < plan->nramp; i++)
+		plan->ramp_time[i] = (float)floor(pow(1.3, i) * 10 + 0.5) / 10;
+}
+
+void CAutoCal::Clear()
+{
+	m_Raw.clear();
+	m_Info.clear();
+}
+
+int CAutoCal::Add(const BYTE *rx, int gain, float int_time, bool dark)
+{
+	int ncol = CTrimReader::ReportCols(rx);
+
+	if (rx[2] != 0x02 || rx[5] >= ncol)			// Not a row report, e.g. the 0xf1 end code
+		return -1;
+
+	int nrows = ncol / TRIM_IMAGER_SIZE;
+	int full = 0;
+
+	for (int r = 0; r < nrows; r++) {
+		RowInfo info;
+		info.gain = gain;
+		info.dark = dark;
+		info.int_time = int_time;
+		m_Info.push_back(info);
+
+		for (int i = 0; i < TRIM_IMAGER_SIZE; i++) {
+			int p = i * nrows + r;
+			BYTE hb = rx[p * 2 + 7], lb = rx[p * 2 + 6];
+
+			m_Raw.push_back((uint16_t)(hb << 8 | lb));
+			if (hb >= AUTOCAL_HB_FULL)
+				full++;
+		}
+	}
+
+	return full;
+}
+
+// Sawtooth per LSB of lb + offset
+
+static inline double SawSlope(int hb)
+{
+	int hbi = hb > 128 ? 128 + (hb - 128) / 2 : hb;
+
+	return (300 - hbi) / 3600.0;
+}
+
+static inline double Sawtooth(int hb, int lb, double offset)
+{
+	return (lb + offset - 128) * SawSlope(hb);
+}
+
+// Offset the correction adds to lb for (hb, lb) with kb row f
+
+static inline double Predict(const double *f, int hb, int lb)
+{
+	double o = hb < 128 ? f[0] * hb + f[1] : f[2] * hb + f[3];
+	double c = f[4];
+
+	if (hb < 16) {
+		o += f[5] / 2;
+		c += f[5] / 10;
+	}
+
+	return o + c * Sawtooth(hb, lb, o);
+}
+
+// Whether a sample takes part in a pass; after the first, f is the previous
+// pass's model. Readings at either end of a byte's range are saturated or
+// stuck and say nothing about the offset.
+
+static inline bool Use(int pass, const double *f, bool ok, int hb, int lb)
+{
+	if (hb == 255 || lb == 0 || lb == 255)
+		return false;
+
+	return !pass || (ok && fabs((hb % 16) * 16 + 7 - lb - Predict(f, hb, lb)) <= AUTOCAL_TRIM);
+}
+
+struct LineSums {
+	double n, sx, sy, sxx, sxy;
+};
+
+static bool SolveLine(const LineSums &s, double *k, double *b)
+{
+	double det = s.n * s.sxx - s.sx * s.sx;
+
+	if (s.n < AUTOCAL_MIN_SAMPLES || det <= 1e-9 * s.n * s.n)
+		return false;
+
+	*k = (s.n * s.sxy - s.sx * s.sy) / det;
+	*b = (s.sy - *k * s.sx) / s.n;
+
+	return true;
+}
+
+// Each pass fits the lines (with the sawtooth of the previous pass removed),
+// then the sawtooth on their residuals, then the hump on what is left. Passes
+// after the first only use samples within AUTOCAL_TRIM of the previous model.
+// The sawtooth regressor depends on lb, whose quantization error is also in d,
+// so it is instrumented with the same term computed from lbp.
+//
+// The hump also shifts the offset the sawtooth is taken at (see Predict). With
+// a the sawtooth slope and s = Sawtooth(hb, lb, o),
+//
+//	d - o - c * s = h * (1/2 + c * a / 2 + s / 10 + h * a / 20)
+//
+// which is solved for h by fixed-point steps, the bracket taken at the
+// previous h (the previous pass's, 0 at first).
+
+void CAutoCal::FitKb(CTrimNode &node, AutoCalResult *res, bool *fitted) const
+{
+	const int nc = TRIM_IMAGER_SIZE;
+	const size_t nrow = m_Info.size();
+
+	double f[TRIM_IMAGER_SIZE][6];
+	bool ok[TRIM_IMAGER_SIZE];
+
+	memset(f, 0, sizeof(f));
+
+	for (int j = 0; j < nc; j++)
+		ok[j] = false;
+
+	for (int pass = 0; pass < AUTOCAL_PASSES; pass++) {
+		LineSums lo[TRIM_IMAGER_SIZE], hi[TRIM_IMAGER_SIZE];
+		double szr[TRIM_IMAGER_SIZE], sxz[TRIM_IMAGER_SIZE], nsaw[TRIM_IMAGER_SIZE];
+		double sur[TRIM_IMAGER_SIZE], suu[TRIM_IMAGER_SIZE], nhump[TRIM_IMAGER_SIZE];
+
+		memset(lo, 0, sizeof(lo));
+		memset(hi, 0, sizeof(hi));
+
+		// Lines
+
+		for (size_t r = 0; r < nrow; r++) {
+			const uint16_t *px = &m_Raw[r * nc];
+
+			for (int j = 0; j < nc; j++) {
+				int hb = px[j] >> 8, lb = px[j] & 0xff;
+				double d = (hb % 16) * 16 + 7 - lb;
+
+				if (hb < 16 || !Use(pass, f[j], ok[j], hb, lb))
+					continue;
+
+				if (pass) {
+					double o = hb < 128 ? f[j][0] * hb + f[j][1] : f[j][2] * hb + f[j][3];
+					d -= f[j][4] * Sawtooth(hb, lb, o);
+				}
+
+				LineSums &s = hb < 128 ? lo[j] : hi[j];
+				s.n++;
+				s.sx += hb;
+				s.sy += d;
+				s.sxx += (double)hb * hb;
+				s.sxy += hb * d;
+			}
+		}
+
+		double g[TRIM_IMAGER_SIZE][6];
+		bool line_ok[TRIM_IMAGER_SIZE];
+
+		for (int j = 0; j < nc; j++) {
+			memset(g[j], 0, sizeof(g[j]));
+
+			bool a = SolveLine(lo[j], &g[j][0], &g[j][1]);
+			bool b = SolveLine(hi[j], &g[j][2], &g[j][3]);
+
+			if (!a && b) {						// Too few samples in one range, extend the other's line
+				g[j][0] = g[j][2];
+				g[j][1] = g[j][3];
+			}
+			else if (a && !b) {
+				g[j][2] = g[j][0];
+				g[j][3] = g[j][1];
+			}
+
+			line_ok[j] = a || b;
+			g[j][5] = ok[j] ? f[j][5] : 0;
+			szr[j] = sxz[j] = nsaw[j] = 0;
+		}
+
+		// Sawtooth above the hump range, then the hump
+
+		for (int step = 0; step <= AUTOCAL_HUMP_ITERS; step++) {
+			for (int j = 0; j < nc; j++)
+				sur[j] = suu[j] = nhump[j] = 0;
+
+			for (size_t r = 0; r < nrow; r++) {
+				const uint16_t *px = &m_Raw[r * nc];
+
+				for (int j = 0; j < nc; j++) {
+					int hb = px[j] >> 8, lb = px[j] & 0xff;
+					int lbp = (hb % 16) * 16 + 7;
+					double d = lbp - lb;
+
+					if (!line_ok[j] || (hb < 16) != (step > 0) || !Use(pass, f[j], ok[j], hb, lb))
+						continue;
+
+					double o = hb < 128 ? g[j][0] * hb + g[j][1] : g[j][2] * hb + g[j][3];
+					double x = Sawtooth(hb, lb, o);
+
+					if (!step) {
+						double z = Sawtooth(hb, lbp, 0);
+						szr[j] += z * (d - o);
+						sxz[j] += x * z;
+						nsaw[j]++;
+					}
+					else {
+						double a = SawSlope(hb);
+						double u = 0.5 + g[j][4] * a / 2 + x / 10 + g[j][5] * a / 20;
+						sur[j] += u * (d - o - g[j][4] * x);
+						suu[j] += u * u;
+						nhump[j]++;
+					}
+				}
+			}
+
+			for (int j = 0; j < nc; j++) {
+				if (!step)
+					g[j][4] = nsaw[j] >= AUTOCAL_MIN_SAMPLES && fabs(sxz[j]) > 1e-9 ? szr[j] / sxz[j] : 0;
+				else
+					g[j][5] = nhump[j] >= AUTOCAL_MIN_SAMPLES && suu[j] > 1e-9 ? sur[j] / suu[j] : 0;
+			}
+		}
+
+		for (int j = 0; j < nc; j++) {
+			if (line_ok[j]) {
+				memcpy(f[j], g[j], sizeof(f[j]));
+				ok[j] = true;
+			}
+		}
+	}
+
+	// Residuals of the final model over the samples it was fitted to
+
+	double se[TRIM_IMAGER_SIZE];
+	int n[TRIM_IMAGER_SIZE];
+
+	for (int j = 0; j < nc; j++) {
+		se[j] = 0;
+		n[j] = 0;
+	}
+
+	for (size_t r = 0; r < nrow; r++) {
+		const uint16_t *px = &m_Raw[r * nc];
+
+		for (int j = 0; j < nc; j++) {
+			int hb = px[j] >> 8, lb = px[j] & 0xff;
+
+			if (Use(AUTOCAL_PASSES, f[j], ok[j], hb, lb)) {
+				double e = (hb % 16) * 16 + 7 - lb - Predict(f[j], hb, lb);
+				se[j] += e * e;
+				n[j]++;
+			}
+		}
+	}
+
+	// Into the node, with the scaling of Convert2Int
+
+	for (int j = 0; j < nc; j++) {
+		res->samples[j] = n[j];
+		res->rms[j] = n[j] ? sqrt(se[j] / n[j]) : 0;
+
+		fitted[j] = ok[j] && n[j] >= AUTOCAL_MIN_SAMPLES;
+		if (!fitted[j])
+			continue;
+
+		for (int i = 0; i < 6; i++)
+			node.kb[j][i] = f[j][i];
+
+		node.kbi[j][0] = (int)round(f[j][0] * 32767);
+		node.kbi[j][1] = (int)round(f[j][1] * 128);
+		node.kbi[j][2] = (int)round(f[j][2] * 32767);
+		node.kbi[j][3] = (int)round(f[j][3] * 128);
+		node.kbi[j][4] = (int)round(f[j][4] * 128);
+		node.kbi[j][5] = (int)round(f[j][5] * 128);
+	}
+}
+
+// Dark frames are corrected with the new kb and no FPN. For each gain and
+// column, the mean over each integration time is fitted with a line whose
+// value at zero integration time is the FPN.
+
+void CAutoCal::FitFpn(CTrimNode &node, AutoCalResult *res) const
+{
+	const int nc = TRIM_IMAGER_SIZE;
+
+	CTrimReader reader;
+	reader.SetNumNode(1);
+	reader.Node[0] = node;
+
+	for (int j = 0; j < nc; j++) {
+		reader.Node[0].fpni[0][j] = 0;
+		reader.Node[0].fpni[1][j] = 0;
+	}
+
+	for (int gain = 0; gain < 2; gain++) {
+		struct Step {
+			float	t;
+			int		n;
+			double	sum[TRIM_IMAGER_SIZE];
+		};
+		std::vector<Step> steps;
+
+		for (size_t r = 0; r < m_Info.size(); r++) {
+			if (!m_Info[r].dark || m_Info[r].gain != gain)
+				continue;
+
+			size_t s = 0;
+			while (s < steps.size() && steps[s].t != m_Info[r].int_time)
+				s++;
+
+			if (s == steps.size()) {
+				Step st;
+				memset(&st, 0, sizeof(st));
+				st.t = m_Info[r].int_time;
+				steps.push_back(st);
+			}
+
+			const uint16_t *px = &m_Raw[r * nc];
+			int flag;
+
+			for (int j = 0; j < nc; j++)
+				steps[s].sum[j] += reader.ADCCorrectioni(j, (BYTE)(px[j] >> 8), (BYTE)px[j], nc, 1, gain, &flag) - DARK_LEVEL;
+			steps[s].n++;
+		}
+
+		if (steps.empty())
+			continue;
+
+		int g = gain ? 0 : 1;					// fpn[0]: low gain, fpn[1]: high gain
+
+		for (int j = 0; j < nc; j++) {
+			LineSums ls;
+			memset(&ls, 0, sizeof(ls));
+
+			for (size_t s = 0; s < steps.size(); s++) {
+				double y = steps[s].sum[j] / steps[s].n;
+				ls.n++;
+				ls.sx += steps[s].t;
+				ls.sy += y;
+				ls.sxx += (double)steps[s].t * steps[s].t;
+				ls.sxy += steps[s].t * y;
+			}
+
+			double k, b;
+			double det = ls.n * ls.sxx - ls.sx * ls.sx;
+
+			if (ls.n >= 2 && det > 1e-9) {
+				k = (ls.n * ls.sxy - ls.sx * ls.sy) / det;
+				b = (ls.sy - k * ls.sx) / ls.n;
+			}
+			else
+				b = ls.sy / ls.n;				// One integration time: its mean
+
+			node.fpn[g][j] = b;
+			node.fpni[g][j] = (int)round(b);
+		}
+
+		res->fpn_ok[g] = 1;
+	}
+}
+
+int CAutoCal::Fit(CTrimNode &node, AutoCalResult *res) const
+{
+	AutoCalResult r;
+	bool fitted[TRIM_IMAGER_SIZE];
+
+	memset(&r, 0, sizeof(r));
+
+	FitKb(node, &r, fitted);
+	FitFpn(node, &r);
+
+	node.version = 3;					// Integer kb/fpn are current
+	node.pending = false;
+
+	if (res)
+		*res = r;
+
+	for (int j = 0; j < TRIM_IMAGER_SIZE; j++)
+		if (!fitted[j])
+			return 0;
+
+	return 1;
+}
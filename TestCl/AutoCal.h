@@ -0,0 +1,83 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "TrimReader.h"
+
+// Automatic calibration: fits one channel's kb matrix and FPN from raw row
+// reports of dark and LED ramp sweeps, in the model ADCCorrectioni applies.
+//
+// For a pixel the high byte hb is the coarse reading (value / 16) and the low
+// byte lb the fine one. Its low nibble predicts lb as lbp = hbln * 16 + 7, so
+// d = lbp - lb is the offset the correction must add, plus quantization noise:
+//
+//	d = k * hb + b										hb < 128
+//	d = k2 * hb + b2									hb >= 128
+//	  + c * (lb + offset - 128) * (300 - hbi) / 3600	sawtooth, hbi: hb above 128 halved
+//	  + h / 2 + h / 10 * sawtooth term					hump, hb < 16
+//
+// k, b, k2, b2, c, h are the kb row of the column (before Convert2Int). Each
+// is a least-squares fit over all of the column's samples; samples the device
+// stuck or wrapped are trimmed after a first pass. FPN is the corrected dark
+// level of the column extrapolated to zero integration time.
+
+#define AUTOCAL_MAX_STEPS	32
+#define AUTOCAL_MIN_SAMPLES	32			// Per column and line, below which a fit falls back
+#define AUTOCAL_HB_FULL		0xf0		// High byte counted as full scale by Add
+
+struct AutoCalPlan {
+	int		frames;						// 12x12 frames per step and gain
+	int		ndark;
+	float	dark_time[AUTOCAL_MAX_STEPS];	// ms, LEDs off
+	int		nramp;
+	float	ramp_time[AUTOCAL_MAX_STEPS];	// ms, channel LED on, ascending; stops once at full scale
+};
+
+void AutoCalDefaultPlan(AutoCalPlan *plan);
+
+struct AutoCalResult {
+	int		samples[TRIM_IMAGER_SIZE];	// Used by the kb fit, after trimming
+	double	rms[TRIM_IMAGER_SIZE];		// Residual of d, LSB of the low byte
+	int		fpn_ok[2];					// FPN fitted for lg, hg (needs dark frames at that gain)
+};
+
+class CAutoCal {
+
+protected:
+
+	// Samples are kept as rows of TRIM_IMAGER_SIZE columns, hb << 8 | lb, so
+	// every pass of the fit runs down the rows with the columns innermost. A
+	// 24 column report becomes two rows, as ADCCorrectioni maps column pairs.
+
+	struct RowInfo {
+		int		gain;					// 0: high gain; 1: low gain
+		bool	dark;
+		float	int_time;
+	};
+
+	std::vector<uint16_t> m_Raw;
+	std::vector<RowInfo> m_Info;
+
+public:
+
+	void Clear();
+	int  GetRows() const { return (int)m_Info.size(); }
+
+	// Adds a row report. Returns the number of its pixels at full scale, -1
+	// if it is not a row report.
+	int  Add(const BYTE *rx, int gain, float int_time, bool dark);
+
+	// Fits kb and FPN into node (kb, fpn and their integer forms, version 3).
+	// A column without enough samples keeps its values, as do the FPN of a
+	// gain without dark frames. Returns 1 if every column was fitted.
+	int  Fit(CTrimNode &node, AutoCalResult *res) const;
+
+protected:
+
+	void FitKb(CTrimNode &node, AutoCalResult *res, bool *fitted) const;
+	void FitFpn(CTrimNode &node, AutoCalResult *res) const;
+};
@@ -0,0 +1,206 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "TrimReader.h"
+#include "CalibFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// CRC-32 (IEEE), table driven
+
+struct CalCrcTable {
+	uint32_t t[256];
+
+	CalCrcTable() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c >> 1) ^ (0xedb88320 & (0 - (c & 1)));
+			t[i] = c;
+		}
+	}
+};
+
+uint32_t CalChecksum(const void *data, size_t len, uint32_t crc)
+{
+	static const CalCrcTable table;
+	const uint8_t *p = (const uint8_t *)data;
+
+	crc = ~crc;
+
+	while (len--)
+		crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+// The checksum field is taken as zero
+
+static uint32_t FileChecksum(const CalFileHeader *h, const CalNode *nodes, uint32_t n)
+{
+	CalFileHeader z = *h;
+	z.checksum = 0;
+
+	return CalChecksum(nodes, n * sizeof(CalNode), CalChecksum(&z, sizeof(z)));
+}
+
+int CTrimReader::SaveCalib(const char *path)
+{
+	if (NumNode < 1 || NumNode > TRIM_MAX_CHANNELS)
+		return 0;
+
+	RestoreNodes();
+
+	CalFileHeader h;
+	std::vector<CalNode> nodes(NumNode);
+
+	memset(&h, 0, sizeof(h));
+	memset(&nodes[0], 0, NumNode * sizeof(CalNode));
+
+	h.magic = CAL_MAGIC;
+	h.version = CAL_VERSION;
+	h.header_bytes = sizeof(CalFileHeader);
+	h.node_bytes = sizeof(CalNode);
+	h.num_nodes = NumNode;
+
+	h.id = id;
+	h.trim_version = version;
+	h.serial_number1 = serial_number1;
+	h.serial_number2 = serial_number2;
+	h.num_channels = num_channels;
+	h.num_wells = num_wells;
+	h.well_format = well_format;
+	h.channel_format = channel_format;
+	memcpy(h.id_str, id_str.data(), id_str.size() < sizeof(h.id_str) ? id_str.size() : sizeof(h.id_str));
+
+	for (int k = 0; k < NumNode; k++) {
+		const CTrimNode &t = Node[k];
+		CalNode &c = nodes[k];
+
+		memcpy(c.kbi, t.kbi, sizeof(c.kbi));
+		memcpy(c.fpni, t.fpni, sizeof(c.fpni));
+		memcpy(c.tempcal, t.tempcal, sizeof(c.tempcal));
+
+		c.rampgen = (uint8_t)t.rampgen;
+		c.range = (uint8_t)t.range;
+		c.auto_v20[0] = (uint8_t)t.auto_v20[0];
+		c.auto_v20[1] = (uint8_t)t.auto_v20[1];
+		c.auto_v15 = (uint8_t)t.auto_v15;
+
+		for (int i = 0; i < t.name.GetLength() && i < CAL_NAME_LEN - 1; i++)
+			c.name[i] = (char)t.name[i];
+	}
+
+	h.checksum = FileChecksum(&h, &nodes[0], NumNode);
+
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return 0;
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&nodes[0], sizeof(CalNode), NumNode, f) == (size_t)NumNode;
+
+	if (fclose(f) != 0)
+		ok = false;
+
+	return ok;
+}
+
+// Nothing is changed unless the whole file checks out
+
+int CTrimReader::LoadCalib(const char *path)
+{
+	const uint8_t *base;
+	size_t size;
+
+#ifdef _WIN32
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+
+	std::vector<uint8_t> buf(sizeof(CalFileHeader) + TRIM_MAX_CHANNELS * sizeof(CalNode) + 1);
+	size = fread(&buf[0], 1, buf.size(), f);
+	fclose(f);
+
+	base = &buf[0];
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CalFileHeader)) {
+		close(fd);
+		return 0;
+	}
+
+	size = st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return 0;
+
+	base = (const uint8_t *)map;
+#endif
+
+	const CalFileHeader *h = (const CalFileHeader *)base;
+	const CalNode *nodes = (const CalNode *)(h + 1);
+
+	int ok = size >= sizeof(CalFileHeader) && h->magic == CAL_MAGIC && h->version == CAL_VERSION &&
+		h->header_bytes == sizeof(CalFileHeader) && h->node_bytes == sizeof(CalNode) &&
+		h->num_nodes >= 1 && h->num_nodes <= TRIM_MAX_CHANNELS &&
+		size == sizeof(CalFileHeader) + h->num_nodes * sizeof(CalNode) &&
+		h->checksum == FileChecksum(h, nodes, h->num_nodes);
+
+	if (ok) {
+		id = h->id;
+		version = h->trim_version;
+		serial_number1 = h->serial_number1;
+		serial_number2 = h->serial_number2;
+		num_channels = h->num_channels;
+		num_wells = h->num_wells;
+		well_format = h->well_format;
+		channel_format = h->channel_format;
+		id_str.assign(h->id_str, strnlen(h->id_str, sizeof(h->id_str)));
+
+		SetNumNode(h->num_nodes);
+
+		for (int k = 0; k < NumNode; k++) {
+			CTrimNode &t = Node[k];
+			const CalNode &c = nodes[k];
+
+			memcpy(t.kbi, c.kbi, sizeof(t.kbi));
+			memcpy(t.fpni, c.fpni, sizeof(t.fpni));
+			memcpy(t.tempcal, c.tempcal, sizeof(t.tempcal));
+
+			t.rampgen = c.rampgen;
+			t.range = c.range;
+			t.auto_v20[0] = c.auto_v20[0];
+			t.auto_v20[1] = c.auto_v20[1];
+			t.auto_v15 = c.auto_v15;
+			t.version = 3;					// Integer kb/fpn, as after an EEPROM read
+			t.pending = false;
+
+			char name[CAL_NAME_LEN + 1];
+			memcpy(name, c.name, CAL_NAME_LEN);
+			name[CAL_NAME_LEN] = 0;
+			t.name = CString(name);
+		}
+	}
+
+#ifndef _WIN32
+	munmap((void *)base, size);
+#endif
+
+	return ok;
+}
@@ -0,0 +1,54 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+
+// Compiled calibration file (.ulscal). Holds the runtime calibration of every
+// node as the correction uses it: integer kb and FPN, register defaults and
+// the EEPROM header fields. No text parsing or Convert2Int is needed, so the
+// file is mapped and copied into the nodes in one step.
+//
+//	CalFileHeader
+//	CalNode[num_nodes]
+//
+// checksum is the CRC-32 of the whole file with the checksum field zero.
+// Fields are little-endian; a reader rejects any other version, header or
+// node size rather than guessing at the layout.
+
+#define CAL_MAGIC			0x4c414355		// "UCAL"
+#define CAL_VERSION			1
+#define CAL_NAME_LEN		16
+
+struct CalFileHeader {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	header_bytes;				// sizeof(CalFileHeader)
+	uint32_t	node_bytes;					// sizeof(CalNode)
+	uint32_t	num_nodes;
+	uint32_t	checksum;
+
+	// EEPROM header (RestoreFromTrimBuff), zero if built from a trim file
+	uint8_t		id;
+	uint8_t		trim_version;
+	uint8_t		serial_number1, serial_number2;
+	uint8_t		num_channels, num_wells, well_format, channel_format;
+	char		id_str[32];
+
+	uint32_t	reserved[5];
+};
+
+struct CalNode {
+	int32_t		kbi[12][6];					// CTrimNode::kbi
+	int32_t		fpni[2][12];				// 0: low gain, 1: high gain
+	double		tempcal[12];
+	uint8_t		rampgen;
+	uint8_t		range;
+	uint8_t		auto_v20[2];				// 0: low gain, 1: high gain
+	uint8_t		auto_v15;
+	uint8_t		reserved[3];
+	char		name[CAL_NAME_LEN];			// DEF name from the trim file
+};
+
+uint32_t CalChecksum(const void *data, size_t len, uint32_t crc = 0);
@@ -0,0 +1,100 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "CalibSet.h"
+
+// All atomics here are sequentially consistent. A reader stores the epoch in
+// its slot before loading m_Current, and a writer swaps m_Current before it
+// advances the epoch and scans the slots. A reader that can still see a
+// replaced set therefore shows an epoch no later than the one the set was
+// retired with.
+
+CCalibRcu::CCalibRcu()
+{
+	CCalibSet *set = new CCalibSet;
+	set->version = 0;
+
+	m_Current.store(set);
+	m_Epoch.store(1);
+	m_Version.store(0);
+
+	for (int i = 0; i < CALIB_MAX_READERS; i++)
+		m_Slots[i].store(0);
+}
+
+CCalibRcu::~CCalibRcu()
+{
+	for (size_t i = 0; i < m_Retired.size(); i++)
+		delete m_Retired[i].set;
+
+	delete m_Current.load();
+}
+
+int CCalibRcu::Register()
+{
+	for (int i = 0; i < CALIB_MAX_READERS; i++) {
+		uint64_t free_slot = 0;
+		if (m_Slots[i].compare_exchange_strong(free_slot, m_Epoch.load()))
+			return i;
+	}
+
+	return -1;
+}
+
+void CCalibRcu::Unregister(int slot)
+{
+	if (slot >= 0 && slot < CALIB_MAX_READERS)
+		m_Slots[slot].store(0);
+}
+
+const CCalibSet *CCalibRcu::Enter(int slot)
+{
+	m_Slots[slot].store(m_Epoch.load());
+
+	return m_Current.load();
+}
+
+uint32_t CCalibRcu::Publish(CCalibSet *set)
+{
+	const CCalibSet *old = m_Current.load();
+
+	set->version = old->version + 1;
+
+	m_Current.store(set);
+	m_Version.store(set->version);
+
+	Retired r;
+	r.set = old;
+	r.epoch = m_Epoch.fetch_add(1);
+	m_Retired.push_back(r);
+
+	Reclaim();
+
+	return set->version;
+}
+
+// A retired set is unreachable once every active slot has entered after it was replaced
+
+void CCalibRcu::Reclaim()
+{
+	uint64_t oldest = UINT64_MAX;
+
+	for (int i = 0; i < CALIB_MAX_READERS; i++) {
+		uint64_t e = m_Slots[i].load();
+		if (e && e < oldest)
+			oldest = e;
+	}
+
+	size_t kept = 0;
+
+	for (size_t i = 0; i < m_Retired.size(); i++) {
+		if (m_Retired[i].epoch < oldest)
+			delete m_Retired[i].set;
+		else
+			m_Retired[kept++] = m_Retired[i];
+	}
+
+	m_Retired.resize(kept);
+}
@@ -0,0 +1,82 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "TrimReader.h"
+#include "DarkLibrary.h"
+
+#define CALIB_MAX_READERS 8
+
+// Everything frame correction reads: the trim nodes (kb matrices, FPN and the
+// register values they were measured with) and the dark references. A set is
+// never changed once published; an update publishes a modified copy.
+
+struct CCalibSet {
+	uint32_t	version;				// Assigned on publication, 0 for the initial empty set
+	CTrimReader	trim;					// All nodes restored, only its const correction methods are used
+	CDarkLibrary dark;
+};
+
+// Publication of calibration sets (read-copy-update). Readers take the current
+// set with one atomic load and no lock, so a new set can be published between
+// two rows of a frame being corrected.
+//
+// Reclamation is quiescent-state based: each reader has a slot and calls Enter
+// at points where it holds no set, typically at the start of each frame. The
+// set returned stays valid until that reader's next Enter. A replaced set is
+// freed by a later Publish once every registered reader has entered since.
+
+class CCalibRcu {
+
+protected:
+
+	struct Retired {
+		const CCalibSet	*set;
+		uint64_t		epoch;			// m_Epoch when it was replaced
+	};
+
+	std::atomic<const CCalibSet *> m_Current;
+	std::atomic<uint64_t> m_Epoch;
+	std::atomic<uint32_t> m_Version;	// Of m_Current, readable without holding a set
+	std::atomic<uint64_t> m_Slots[CALIB_MAX_READERS];	// Epoch at the reader's last Enter, 0: free
+
+	std::mutex	m_WriteLock;			// Serializes writers only
+	std::vector<Retired> m_Retired;
+
+public:
+
+	CCalibRcu();
+	~CCalibRcu();
+
+	int  Register();					// Reader slot, -1 if all are taken
+	void Unregister(int slot);
+	const CCalibSet *Enter(int slot);	// Current set, valid until the next Enter on slot
+
+	uint32_t GetVersion() { return m_Version.load(); }
+
+	// Copies the current set, lets fn change the copy and publishes it unless
+	// fn returns false. Returns the new version, 0 if nothing was published.
+	template <typename F> uint32_t Update(F fn)
+	{
+		std::lock_guard<std::mutex> lock(m_WriteLock);
+
+		CCalibSet *set = new CCalibSet(*m_Current.load());
+		if (!fn(*set)) {
+			delete set;
+			return 0;
+		}
+
+		return Publish(set);
+	}
+
+protected:
+
+	uint32_t Publish(CCalibSet *set);	// m_WriteLock held
+	void Reclaim();
+};
@@ -0,0 +1,268 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "CoDevice.h"
+
+#if __cplusplus >= 202002L
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "MonoClock.h"
+
+#define LOOP_MAX_EVENTS 16
+
+// Timers share one timerfd armed for the earliest deadline, so sleeps keep
+// CLOCK_MONOTONIC resolution instead of the millisecond epoll timeout.
+
+static void ArmTimer(int fd, uint64_t deadline)
+{
+	struct itimerspec its = {};
+
+	if (deadline) {
+		its.it_value.tv_sec = (time_t)(deadline / 1000000000ull);
+		its.it_value.tv_nsec = (long)(deadline % 1000000000ull);
+	}
+
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);		// 0 disarms
+}
+
+static int g_TimerTag;			// epoll tag of the loop's timerfd
+
+/////////////////////////////////////////////////////////////////////////////
+// Awaitables
+/////////////////////////////////////////////////////////////////////////////
+
+bool CoOp::await_suspend(std::coroutine_handle<> h)
+{
+	int id = dev->m_Async.Submit(op, chan, ival, fval, NULL, NULL);
+
+	if (!id) {
+		status = ASYNC_FAILED;
+		return false;
+	}
+
+	status = ASYNC_PENDING;
+	waiter = h;
+	dev->m_Waiting[id] = this;
+
+	return true;
+}
+
+bool CoSleep::await_ready() const
+{
+	return MonoTimeNs() >= deadline;
+}
+
+void CoSleep::await_suspend(std::coroutine_handle<> h)
+{
+	loop->m_Timers.insert(std::make_pair(deadline, h));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CDeviceLoop
+/////////////////////////////////////////////////////////////////////////////
+
+CDeviceLoop::CDeviceLoop()
+{
+	m_Quit = false;
+	m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+	m_TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (m_Epoll >= 0 && m_TimerFd >= 0) {
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = &g_TimerTag;
+		epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_TimerFd, &ev);
+	}
+}
+
+CDeviceLoop::~CDeviceLoop()
+{
+	m_Tasks.clear();			// Destroys suspended coroutine frames
+
+	if (m_TimerFd >= 0)
+		close(m_TimerFd);
+	if (m_Epoll >= 0)
+		close(m_Epoll);
+}
+
+void CDeviceLoop::Spawn(CoTask &&task)
+{
+	CoTask::Handle h = task.GetHandle();
+
+	if (!h)
+		return;
+
+	m_Tasks.push_back(std::move(task));
+	h.resume();					// Runs up to its first suspension
+}
+
+CoSleep CDeviceLoop::Sleep(float ms)
+{
+	return CoSleep{ this, MonoTimeNs() + (uint64_t)(ms * 1000000.0f) };
+}
+
+int CDeviceLoop::Attach(CCoDevice *dev)
+{
+	int fd = dev->m_Async.GetEventFd();
+
+	if (m_Epoll < 0 || fd < 0)
+		return 0;
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = dev;
+
+	return epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void CDeviceLoop::Detach(CCoDevice *dev)
+{
+	int fd = dev->m_Async.GetEventFd();
+
+	if (m_Epoll >= 0 && fd >= 0)
+		epoll_ctl(m_Epoll, EPOLL_CTL_DEL, fd, NULL);
+}
+
+void CDeviceLoop::FireTimers()
+{
+	uint64_t v;
+	ssize_t r = read(m_TimerFd, &v, sizeof(v));		// EAGAIN is fine, deadlines are checked below
+	(void)r;
+
+	uint64_t now = MonoTimeNs();
+
+	// Resuming may add timers, so take one at a time from the front
+
+	while (!m_Timers.empty() && m_Timers.begin()->first <= now) {
+		std::coroutine_handle<> h = m_Timers.begin()->second;
+		m_Timers.erase(m_Timers.begin());
+		h.resume();
+	}
+}
+
+void CDeviceLoop::Reap()
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < m_Tasks.size(); i++) {
+		if (!m_Tasks[i].Done()) {
+			if (n != i)
+				m_Tasks[n] = std::move(m_Tasks[i]);
+			n++;
+		}
+	}
+
+	m_Tasks.resize(n);
+}
+
+int CDeviceLoop::RunOnce(int timeout_ms)
+{
+	if (m_Epoll < 0)
+		return -1;
+
+	ArmTimer(m_TimerFd, m_Timers.empty() ? 0 : m_Timers.begin()->first);
+
+	struct epoll_event ev[LOOP_MAX_EVENTS];
+	int n = epoll_wait(m_Epoll, ev, LOOP_MAX_EVENTS, timeout_ms);
+
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for (int i = 0; i < n; i++) {
+		if (ev[i].data.ptr == &g_TimerTag)
+			FireTimers();
+		else
+			((CCoDevice *)ev[i].data.ptr)->Dispatch();
+	}
+
+	Reap();
+
+	return n;
+}
+
+int CDeviceLoop::Run()
+{
+	m_Quit = false;
+
+	Reap();
+
+	while (!m_Quit && !m_Tasks.empty()) {
+		if (RunOnce(-1) < 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CCoDevice
+/////////////////////////////////////////////////////////////////////////////
+
+CCoDevice::CCoDevice(CDeviceLoop *pLoop, CInterfaceObject *pObj, std::recursive_mutex *pDeviceLock)
+	: m_pLoop(pLoop), m_Async(pObj, pDeviceLock)
+{
+	m_pLoop->Attach(this);
+}
+
+CCoDevice::~CCoDevice()
+{
+	m_pLoop->Detach(this);
+}
+
+CoOp CCoDevice::Capture(int chan, int size, int *dst, FrameMeta *meta)
+{
+	return CoOp{ this, size == 24 ? ASYNC_OP_CAPTURE24 : ASYNC_OP_CAPTURE12, chan, 0, 0, dst, meta, ASYNC_PENDING, nullptr };
+}
+
+CoOp CCoDevice::CaptureDiff(int chan, int *dst, FrameMeta *meta)
+{
+	return CoOp{ this, ASYNC_OP_DIFF12, chan, 0, 0, dst, meta, ASYNC_PENDING, nullptr };
+}
+
+CoOp CCoDevice::SelectChannel(int chan)
+{
+	return CoOp{ this, ASYNC_OP_SELCHAN, chan, 0, 0, NULL, NULL, ASYNC_PENDING, nullptr };
+}
+
+CoOp CCoDevice::SetGain(int gain)
+{
+	return CoOp{ this, ASYNC_OP_SETGAIN, 0, gain, 0, NULL, NULL, ASYNC_PENDING, nullptr };
+}
+
+CoOp CCoDevice::SetIntTime(float ms)
+{
+	return CoOp{ this, ASYNC_OP_SETINTTIME, 0, 0, ms, NULL, NULL, ASYNC_PENDING, nullptr };
+}
+
+void CCoDevice::Dispatch()
+{
+	int ids[LOOP_MAX_EVENTS];
+	int n;
+
+	do {
+		n = m_Async.PollCompleted(ids, LOOP_MAX_EVENTS);
+
+		for (int i = 0; i < n; i++) {
+			std::map<int, CoOp *>::iterator it = m_Waiting.find(ids[i]);
+
+			if (it == m_Waiting.end()) {
+				m_Async.Release(ids[i]);
+				continue;
+			}
+
+			CoOp *op = it->second;
+			m_Waiting.erase(it);
+
+			op->status = m_Async.Collect(ids[i], op->meta, op->dst);
+			op->waiter.resume();			// May submit further operations
+		}
+	} while (n == LOOP_MAX_EVENTS);
+}
+
+#endif
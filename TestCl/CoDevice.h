@@ -0,0 +1,201 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+// Coroutine interface over CAsyncCapture. Requires C++20; the rest of the
+// library stays C++14, so this header is empty for older standards.
+//
+//	CoTask Run(CCoDevice &dev, int (*frames)[144])
+//	{
+//		co_await dev.SetGain(1);
+//		for (int ch = 1; ch <= 4; ch++)
+//			co_await dev.Capture(ch, 12, frames[ch - 1]);
+//		co_await dev.GetLoop()->Sleep(5000);		// thermal step
+//		co_return 0;
+//	}
+//
+//	CDeviceLoop loop;
+//	CCoDevice dev(&loop, &obj, &lock);
+//	loop.Spawn(Run(dev, frames));
+//	loop.Run();
+//
+// Everything runs on the thread calling CDeviceLoop::Run: device completions
+// arrive through the CAsyncCapture eventfd and timers through a timerfd,
+// both in one epoll set, so any number of scripts share that thread without
+// blocking. The HID state in HidMgr.cpp is global, so only one device can be
+// open: attach a single CCoDevice per process. A task's coroutine frame is
+// allocated once when it is created; awaiting an operation allocates nothing
+// beyond the CAsyncCapture request.
+
+#if __cplusplus >= 202002L
+
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#include "AsyncCapture.h"
+
+class CDeviceLoop;
+class CCoDevice;
+
+// Awaitable task returning int (0 or an ASYNC_xxx status by convention).
+// Starts suspended; runs when spawned on a loop or awaited by another task.
+
+class CoTask {
+
+public:
+
+	struct promise_type {
+		int result = 0;
+		std::coroutine_handle<> continuation;
+
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				std::coroutine_handle<> c = h.promise().continuation;
+				return c ? c : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+
+		CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_value(int r) { result = r; }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	CoTask() : m_h(nullptr) {}
+	explicit CoTask(Handle h) : m_h(h) {}
+	CoTask(CoTask &&t) noexcept : m_h(t.m_h) { t.m_h = nullptr; }
+	CoTask &operator=(CoTask &&t) noexcept {
+		if (this != &t) { Destroy(); m_h = t.m_h; t.m_h = nullptr; }
+		return *this;
+	}
+	CoTask(const CoTask &) = delete;
+	CoTask &operator=(const CoTask &) = delete;
+	~CoTask() { Destroy(); }
+
+	bool Done() const { return !m_h || m_h.done(); }
+	int  Result() const { return m_h ? m_h.promise().result : 0; }
+	Handle GetHandle() const { return m_h; }
+
+	// co_await task: runs it and resumes the awaiter when it finishes
+
+	bool await_ready() const { return Done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+		m_h.promise().continuation = h;
+		return m_h;
+	}
+	int await_resume() const { return Result(); }
+
+private:
+
+	void Destroy() { if (m_h) m_h.destroy(); m_h = nullptr; }
+
+	Handle m_h;
+};
+
+// One pending device operation, lives in the awaiting coroutine's frame
+
+struct CoOp {
+	CCoDevice	*dev;
+	int			op;
+	int			chan;
+	int			ival;
+	float		fval;
+	int			*dst;				// Capture ops: size x size ints, may be NULL
+	FrameMeta	*meta;				// May be NULL
+
+	int			status;
+	std::coroutine_handle<> waiter;
+
+	bool await_ready() const { return false; }
+	bool await_suspend(std::coroutine_handle<> h);		// false if the submit failed
+	int  await_resume() const { return status; }		// ASYNC_DONE or ASYNC_FAILED
+};
+
+struct CoSleep {
+	CDeviceLoop	*loop;
+	uint64_t	deadline;			// MonoTimeNs
+
+	bool await_ready() const;
+	void await_suspend(std::coroutine_handle<> h);
+	void await_resume() const {}
+};
+
+class CDeviceLoop {
+
+	friend class CCoDevice;
+	friend struct CoSleep;
+
+protected:
+
+	int			m_Epoll;
+	int			m_TimerFd;
+	bool		m_Quit;
+
+	std::vector<CoTask> m_Tasks;							// Spawned, owned by the loop
+	std::multimap<uint64_t, std::coroutine_handle<> > m_Timers;		// By deadline
+
+public:
+
+	CDeviceLoop();
+	~CDeviceLoop();
+
+	void Spawn(CoTask &&task);				// Runs the task to its first suspension, the loop owns it
+	int  Run();								// Returns when all spawned tasks are done or Stop is called
+	int  RunOnce(int timeout_ms);			// One dispatch round, -1 waits for the next event
+	void Stop() { m_Quit = true; }
+	int  GetTaskCount() const { return (int)m_Tasks.size(); }
+
+	CoSleep Sleep(float ms);
+	CoSleep SleepUntil(uint64_t deadline_ns) { return CoSleep{ this, deadline_ns }; }
+
+protected:
+
+	int  Attach(CCoDevice *dev);
+	void Detach(CCoDevice *dev);
+	void FireTimers();
+	void Reap();
+};
+
+// A device driven by a CDeviceLoop. Operations run in order on the device's
+// CAsyncCapture worker; pObj and pDeviceLock are shared with synchronous users
+// the same way as for CAsyncCapture.
+
+class CCoDevice {
+
+	friend class CDeviceLoop;
+	friend struct CoOp;
+
+protected:
+
+	CDeviceLoop		*m_pLoop;
+	CAsyncCapture	m_Async;
+	std::map<int, CoOp *> m_Waiting;		// By request id
+
+public:
+
+	CCoDevice(CDeviceLoop *pLoop, CInterfaceObject *pObj, std::recursive_mutex *pDeviceLock);
+	~CCoDevice();
+
+	CDeviceLoop *GetLoop() { return m_pLoop; }
+
+	CoOp Capture(int chan, int size, int *dst, FrameMeta *meta = NULL);
+	CoOp CaptureDiff(int chan, int *dst, FrameMeta *meta = NULL);
+	CoOp SelectChannel(int chan);
+	CoOp SetGain(int gain);
+	CoOp SetIntTime(float ms);
+
+protected:
+
+	void Dispatch();						// Resumes the coroutines whose requests finished
+};
+
+#endif
@@ -0,0 +1,66 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// Wire protocol of uls24d, the capture daemon that owns the device on behalf
+// of several local tools. Clients connect to a Unix stream socket and write
+// fixed-size requests; each request gets exactly one reply, in completion
+// order (match them by tag). Both ends are on the same host, so structs are
+// sent in native byte order and layout.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "InterfaceWrapper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ULS24D_MAGIC        0x44343255      // "U24D"
+#define ULS24D_SOCKET       "/tmp/uls24d.sock"
+
+#define ULS24D_OP_CAPTURE   1
+
+#define ULS24D_OK           0
+#define ULS24D_ERR_ARGS     -1
+#define ULS24D_ERR_DEVICE   -2
+#define ULS24D_ERR_EXPIRED  -3              // Deadline passed before a capture could start
+#define ULS24D_ERR_BUSY     -4              // Queue full
+
+// Requests for the same channel, size, gain and integration time that are
+// queued together are served by one capture. A request may also take a frame
+// whose capture started at most max_age_us before the request arrived, either
+// the one in progress or the last one taken with those settings.
+//
+// The queue is ordered by priority (higher first), then deadline, then arrival.
+// A capture in progress is never aborted, so the worst-case wait of a top
+// priority request is one frame time plus its own.
+
+typedef struct {
+    uint32_t magic;
+    uint32_t tag;               // Echoed in the reply
+    uint16_t op;                // ULS24D_OP_xxx
+    uint8_t  channel;           // 1-4
+    uint8_t  size;              // 12 or 24
+    uint8_t  gain;              // 0: high, 1: low
+    int8_t   priority;
+    uint16_t reserved;
+    float    int_time_ms;
+    uint32_t deadline_us;       // Relative to receipt, 0: none
+    uint32_t max_age_us;        // 0: a capture started after the request
+} ULS24D_Request;
+
+// Followed by meta.size * meta.size int32 pixels if status is ULS24D_OK
+
+typedef struct {
+    uint32_t magic;
+    uint32_t tag;
+    int32_t  status;            // ULS24D_xxx
+    uint32_t shared;            // Requests served by the same capture, including this one
+    ULS24_FrameMeta meta;
+} ULS24D_Reply;
+
+#ifdef __cplusplus
+}
+#endif
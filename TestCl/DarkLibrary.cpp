@@ -0,0 +1,148 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "DarkLibrary.h"
+
+#define DARK_FILE_MAGIC   0x4b524144		// "DARK"
+#define DARK_FILE_VERSION 1
+
+CDarkLibrary::CDarkLibrary()
+{
+	m_Version = 0;
+}
+
+// Replaces an existing reference with the same key
+
+void CDarkLibrary::Add(int chan, int gain, int size, float int_time, const int *data, int navg)
+{
+	DarkFrame *f = NULL;
+
+	for (size_t i = 0; i < m_Frames.size(); i++) {
+		DarkFrame &e = m_Frames[i];
+		if (e.chan == chan && e.gain == gain && e.size == size && e.int_time == int_time) {
+			f = &e;
+			break;
+		}
+	}
+
+	if (!f) {
+		m_Frames.push_back(DarkFrame());
+		f = &m_Frames.back();
+	}
+
+	f->chan = chan;
+	f->gain = gain;
+	f->size = size;
+	f->int_time = int_time;
+	f->navg = navg;
+	memcpy(f->data, data, size * size * sizeof(int));
+
+	m_Version++;
+}
+
+void CDarkLibrary::Clear()
+{
+	m_Frames.clear();
+	m_Version++;
+}
+
+int CDarkLibrary::Lookup(int chan, int gain, int size, float int_time, int *out) const
+{
+	const DarkFrame *lo = NULL, *hi = NULL;		// Nearest at or below / above int_time
+	const DarkFrame *lo2 = NULL, *hi2 = NULL;	// Next nearest, for extrapolation
+
+	for (size_t i = 0; i < m_Frames.size(); i++) {
+		const DarkFrame &e = m_Frames[i];
+		if (e.chan != chan || e.gain != gain || e.size != size)
+			continue;
+
+		if (e.int_time <= int_time) {
+			if (!lo || e.int_time > lo->int_time) { lo2 = lo; lo = &e; }
+			else if (!lo2 || e.int_time > lo2->int_time) lo2 = &e;
+		}
+		else {
+			if (!hi || e.int_time < hi->int_time) { hi2 = hi; hi = &e; }
+			else if (!hi2 || e.int_time < hi2->int_time) hi2 = &e;
+		}
+	}
+
+	const DarkFrame *a, *b;
+
+	if (lo && hi) { a = lo; b = hi; }
+	else if (lo && lo2) { a = lo2; b = lo; }
+	else if (hi && hi2) { a = hi; b = hi2; }
+	else if (lo || hi) {
+		memcpy(out, (lo ? lo : hi)->data, size * size * sizeof(int));
+		return 1;
+	}
+	else return 0;
+
+	if (a->int_time == int_time) {
+		memcpy(out, a->data, size * size * sizeof(int));
+		return 1;
+	}
+
+	double w = (double)(int_time - a->int_time) / (double)(b->int_time - a->int_time);
+
+	for (int i = 0; i < size * size; i++) {
+		int v = (int)round(a->data[i] + w * (b->data[i] - a->data[i]));
+		out[i] = v < 0 ? 0 : v;
+	}
+
+	return 1;
+}
+
+int CDarkLibrary::Save(const char *path) const
+{
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+		return 0;
+
+	int hdr[3] = { DARK_FILE_MAGIC, DARK_FILE_VERSION, (int)m_Frames.size() };
+	bool ok = fwrite(hdr, sizeof(hdr), 1, fp) == 1;
+
+	if (ok && !m_Frames.empty())
+		ok = fwrite(&m_Frames[0], sizeof(DarkFrame), m_Frames.size(), fp) == m_Frames.size();
+
+	if (fclose(fp))
+		ok = false;
+
+	return ok ? 1 : 0;
+}
+
+// Entries are merged into the library, replacing any with the same key
+
+int CDarkLibrary::Load(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return 0;
+
+	int hdr[3];
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1 || hdr[0] != DARK_FILE_MAGIC || hdr[1] != DARK_FILE_VERSION || hdr[2] < 0) {
+		fclose(fp);
+		return 0;
+	}
+
+	std::vector<DarkFrame> frames(hdr[2]);
+	bool ok = frames.empty() || fread(&frames[0], sizeof(DarkFrame), frames.size(), fp) == frames.size();
+	fclose(fp);
+
+	if (!ok)
+		return 0;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		const DarkFrame &f = frames[i];
+		if ((f.size != 12 && f.size != 24) || f.chan < 1 || f.chan > 4)
+			return 0;
+	}
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		const DarkFrame &f = frames[i];
+		Add(f.chan, f.gain, f.size, f.int_time, f.data, f.navg);
+	}
+
+	return 1;
+}
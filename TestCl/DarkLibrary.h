@@ -0,0 +1,43 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <vector>
+
+#define DARK_MAX_PIXELS (24 * 24)
+
+struct DarkFrame {
+	int		chan;					// 1-4
+	int		gain;					// 0: high gain; 1: low gain
+	int		size;					// 12 or 24
+	float	int_time;				// ms
+	int		navg;					// Number of frames averaged
+	int		data[DARK_MAX_PIXELS];	// size x size row-major, corrected counts including DARK_LEVEL
+};
+
+// Full-frame dark references keyed by (channel, gain, frame size, integration time).
+// Dark current is linear in integration time, so references for other
+// integration times are interpolated (or extrapolated) from the two nearest.
+
+class CDarkLibrary {
+
+protected:
+
+	std::vector<DarkFrame> m_Frames;
+	unsigned int m_Version;			// Bumped on every change, lets users cache lookups
+
+public:
+
+	CDarkLibrary();
+
+	void Add(int chan, int gain, int size, float int_time, const int *data, int navg);
+	int  Lookup(int chan, int gain, int size, float int_time, int *out) const;		// 1: out filled
+	void Clear();
+
+	int  GetCount() const { return (int)m_Frames.size(); }
+	unsigned int GetVersion() const { return m_Version; }
+
+	int  Save(const char *path) const;
+	int  Load(const char *path);
+};
@@ -0,0 +1,87 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "FpnRefresh.h"
+
+CFpnRefresh::CFpnRefresh()
+{
+	Configure(0, 0);
+}
+
+void CFpnRefresh::Configure(int period, double alpha)
+{
+	m_Period = period > 0 ? period : 0;
+	m_Alpha = alpha < 0 ? 0 : (alpha > 1 ? 1 : alpha);
+	m_Count = 0;
+	m_Updates = 0;
+
+	memset(m_Track, 0, sizeof(m_Track));
+}
+
+bool CFpnRefresh::Tick()
+{
+	if (!m_Period || ++m_Count < m_Period)
+		return false;
+
+	m_Count = 0;
+
+	return true;
+}
+
+int CFpnRefresh::Update(int chan, int gain, const CTrimNode &node, const int *frame, const BYTE *flags, int stride,
+						double *fpn, int *fpni)
+{
+	const int nc = TRIM_IMAGER_SIZE;
+
+	if (chan < 1 || chan > TRIM_MAX_CHANNELS || (gain != 0 && gain != 1))
+		return 0;
+
+	Track &t = m_Track[chan - 1][gain];
+	int g = gain ? 0 : 1;					// fpn[0]: low gain, fpn[1]: high gain
+
+	bool same = t.valid;
+	for (int j = 0; j < nc && same; j++)
+		same = t.fpni[j] == node.fpni[g][j];
+
+	if (!same) {
+		for (int j = 0; j < nc; j++)
+			t.fpn[j] = node.fpni[g][j];
+		t.valid = true;
+	}
+
+	int updated = 0;
+
+	for (int j = 0; j < nc; j++) {
+		int sum = 0, n = 0;
+
+		for (int i = 0; i < nc; i++) {
+			int v = frame[i * stride + j];
+
+			if (flags[i * stride + j] || v <= 0)	// Clipped at 0, the level is unknown
+				continue;
+
+			sum += v - DARK_LEVEL;
+			n++;
+		}
+
+		if (n >= FPN_MIN_ROWS) {
+			double measured = node.fpni[g][j] + (double)sum / n;
+
+			t.fpn[j] += m_Alpha * (measured - t.fpn[j]);
+			updated++;
+		}
+
+		t.fpni[j] = (int)round(t.fpn[j]);
+		fpn[j] = t.fpn[j];
+		fpni[j] = t.fpni[j];
+	}
+
+	m_Updates++;
+
+	return updated;
+}
@@ -0,0 +1,59 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include "TrimReader.h"
+
+#define FPN_MIN_ROWS	6				// Usable dark pixels per column for its FPN to be updated
+
+// Online FPN tracking. Every period-th lit 12x12 frame of a stream is followed
+// by one dark capture; each column's FPN is moved towards the level measured in
+// it by an exponential moving average:
+//
+//	fpn += alpha * (measured - fpn)
+//
+// The dark frame is corrected with the calibration in use (and the dark
+// reference, if any), so measured is the current FPN plus the column's mean
+// excess over DARK_LEVEL. Without a dark reference for the stream's settings,
+// the dark current of its integration time is taken into the FPN as well.
+//
+// The averages are kept per channel and gain at full precision, so rounding to
+// the integer FPN does not stall small updates. They restart from the
+// calibration whenever it no longer holds the values last produced, e.g.
+// after a calibration load.
+
+class CFpnRefresh {
+
+protected:
+
+	struct Track {
+		bool	valid;
+		double	fpn[TRIM_IMAGER_SIZE];
+		int		fpni[TRIM_IMAGER_SIZE];	// Last produced, to notice a replaced calibration
+	};
+
+	int		m_Period;					// Lit frames between dark captures, 0: off
+	double	m_Alpha;
+	int		m_Count;
+	int		m_Updates;
+	Track	m_Track[TRIM_MAX_CHANNELS][2];
+
+public:
+
+	CFpnRefresh();
+
+	void Configure(int period, double alpha);	// Restarts the averages
+	int  GetPeriod() const { return m_Period; }
+	int  GetUpdates() const { return m_Updates; }	// Dark frames folded in since Configure
+
+	bool Tick();						// Counts a lit frame, true when a dark capture is due
+
+	// Folds a corrected 12x12 dark frame (row stride stride, flags at the same
+	// offsets: nonzero where ADCCorrectioni over/underflowed) of chan at gain
+	// into its average, starting from node. fpn and fpni receive the new
+	// values of node's FPN row for that gain. Returns the number of columns
+	// updated.
+	int  Update(int chan, int gain, const CTrimNode &node, const int *frame, const BYTE *flags, int stride,
+				double *fpn, int *fpni);
+};
@@ -0,0 +1,168 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "FrameRing.h"
+
+CFrameRing::CFrameRing(int frames)
+{
+	m_Slots = NULL;
+	m_Capacity = 0;
+	m_Next = 0;
+
+	SetCapacity(frames < 2 ? 2 : frames);
+}
+
+CFrameRing::~CFrameRing()
+{
+	delete[] m_Slots;
+}
+
+// GetRange leaves out the slot the writer reuses next, so one more slot than
+// the frames kept is needed.
+
+int CFrameRing::SetCapacity(int frames)
+{
+	if (frames < 2)
+		return 0;
+
+	delete[] m_Slots;
+
+	m_Slots = new FrameSlot[frames];
+	m_Capacity = frames;
+
+	for (int i = 0; i < frames; i++)
+		m_Slots[i].stamp.store(0, std::memory_order_relaxed);
+
+	m_Next.store(0, std::memory_order_release);
+
+	return 1;
+}
+
+int CFrameRing::SetMemoryLimit(size_t bytes)
+{
+	return SetCapacity((int)(bytes / sizeof(FrameSlot)));
+}
+
+uint64_t CFrameRing::Push(const FrameMeta &meta, const int *frame, int stride)
+{
+	uint64_t seq = m_Next.load(std::memory_order_relaxed);
+	FrameSlot &slot = m_Slots[seq % m_Capacity];
+
+	slot.stamp.store(2 * seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.meta = meta;
+	slot.meta.seq = seq;
+
+	int dim = meta.size;
+	for (int i = 0; i < dim; i++)
+		memcpy(&slot.data[i * dim], frame + i * stride, dim * sizeof(int));
+
+	slot.stamp.store(2 * seq + 2, std::memory_order_release);
+	m_Next.store(seq + 1, std::memory_order_release);
+
+	return seq;
+}
+
+int CFrameRing::GetRange(uint64_t *first, uint64_t *last)
+{
+	uint64_t next = m_Next.load(std::memory_order_acquire);
+
+	if (!next)
+		return 0;
+
+	// The oldest slot is the one the writer will reuse next, leave it out
+	*first = next > (uint64_t)m_Capacity - 1 ? next - (m_Capacity - 1) : 0;
+	*last = next - 1;
+
+	return 1;
+}
+
+const FrameSlot *CFrameRing::Peek(uint64_t seq)
+{
+	const FrameSlot *slot = &m_Slots[seq % m_Capacity];
+
+	if (slot->stamp.load(std::memory_order_acquire) != 2 * seq + 2)
+		return NULL;
+
+	return slot;
+}
+
+bool CFrameRing::Validate(const FrameSlot *slot, uint64_t seq)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return slot->stamp.load(std::memory_order_relaxed) == 2 * seq + 2;
+}
+
+int CFrameRing::Copy(uint64_t seq, FrameMeta *meta, int *data)
+{
+	const FrameSlot *slot = Peek(seq);
+
+	if (!slot)
+		return 0;
+
+	FrameMeta m = slot->meta;
+	if (data)
+		memcpy(data, slot->data, m.size * m.size * sizeof(int));
+
+	if (!Validate(slot, seq))
+		return 0;
+
+	if (meta) *meta = m;
+
+	return 1;
+}
+
+uint64_t CFrameRing::StartTime(uint64_t seq, bool *ok)
+{
+	const FrameSlot *slot = Peek(seq);
+
+	*ok = false;
+	if (!slot)
+		return 0;
+
+	uint64_t t = slot->meta.t_start;
+	*ok = Validate(slot, seq);
+
+	return t;
+}
+
+// Frames are pushed in capture order, so t_start is monotonic in seq and the
+// window can be found with two binary searches.
+
+int CFrameRing::FindTime(uint64_t t0, uint64_t t1, uint64_t *first, uint64_t *last)
+{
+	uint64_t lo, hi;
+	bool ok;
+
+	if (t1 <= t0 || !GetRange(&lo, &hi))
+		return 0;
+
+	uint64_t a = lo, b = hi + 1;				// First seq with t_start >= t0
+	while (a < b) {
+		uint64_t m = a + (b - a) / 2;
+		uint64_t t = StartTime(m, &ok);
+		if (!ok) { a = m + 1; continue; }	// Recycled under us, it was older than anything live
+		if (t < t0) a = m + 1; else b = m;
+	}
+	uint64_t s0 = a;
+
+	b = hi + 1;									// First seq with t_start >= t1
+	while (a < b) {
+		uint64_t m = a + (b - a) / 2;
+		uint64_t t = StartTime(m, &ok);
+		if (!ok) { a = m + 1; continue; }
+		if (t < t1) a = m + 1; else b = m;
+	}
+
+	if (a == s0)
+		return 0;
+
+	*first = s0;
+	*last = a - 1;
+
+	return 1;
+}
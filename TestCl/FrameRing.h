@@ -0,0 +1,69 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#define RING_FRAME_PIXELS (24 * 24)
+#define RING_DEFAULT_FRAMES 256
+
+#define FRAME_FLAG_DIFF		0x1			// LED on minus LED off, signed
+
+struct FrameMeta {
+	uint64_t	seq;				// Capture sequence number, starts at 0
+	uint64_t	t_start;			// Capture command sent, MonoTimeNs() clock
+	uint64_t	t_end;				// Last row received
+	int			chan;				// 1-4
+	int			gain;				// 0: high gain; 1: low gain
+	float		int_time;			// ms
+	int			size;				// 12 or 24, data is size x size row-major
+	int			flags;				// FRAME_FLAG_xxx
+	uint32_t	calib;				// Version of the calibration set it was corrected with (CalibSet.h)
+};
+
+// A slot is stable while its stamp is even and equal to 2 * (meta.seq + 1).
+// The writer makes it odd for the duration of the copy (seqlock).
+
+struct FrameSlot {
+	std::atomic<uint64_t>	stamp;
+	FrameMeta				meta;
+	int						data[RING_FRAME_PIXELS];
+};
+
+// Bounded history of recent frames. One writer (the capture thread), any number
+// of readers. Readers get pointers into the ring and must call Validate() after
+// using the data; a false result means the slot was recycled meanwhile.
+
+class CFrameRing {
+
+protected:
+
+	FrameSlot	*m_Slots;
+	int			m_Capacity;
+	std::atomic<uint64_t>	m_Next;		// Sequence number of the next frame to be written
+
+public:
+
+	CFrameRing(int frames = RING_DEFAULT_FRAMES);
+	~CFrameRing();
+
+	int  SetCapacity(int frames);		// At least 2. Drops the history. Not safe while capturing.
+	int  SetMemoryLimit(size_t bytes);
+	int  GetCapacity() { return m_Capacity; }
+
+	uint64_t Push(const FrameMeta &meta, const int *frame, int stride);	// frame: meta.size rows, stride ints apart. meta.seq is assigned here
+
+	int  GetRange(uint64_t *first, uint64_t *last);		// Live sequence numbers, 0 if empty
+	const FrameSlot *Peek(uint64_t seq);				// NULL if seq is not (or no longer) in the ring
+	bool Validate(const FrameSlot *slot, uint64_t seq);
+	int  Copy(uint64_t seq, FrameMeta *meta, int *data);	// Consistent copy, 1: success
+
+	// Sequence numbers of frames with t_start in [t0, t1), 0 if none
+	int  FindTime(uint64_t t0, uint64_t t1, uint64_t *first, uint64_t *last);
+
+protected:
+
+	uint64_t StartTime(uint64_t seq, bool *ok);
+};
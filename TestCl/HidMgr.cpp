@@ -5,6 +5,7 @@
 
 #include "HidMgr.h"
 #include "TrimReader.h"
+#include "HidTrace.h"
 
 //Application global variables 
 char                InputReport[HIDREPORTNUM];
@@ -33,6 +34,13 @@ bool FindTheHID()
     //Use hidapi to find a device with specified Vendor ID and Product ID.
     struct hid_device_info *devs, *cur_dev;
     
+    // A trace being replayed or a simulated device stands in for the device
+    if (HidTraceReplaying()) {
+        MyDeviceDetected = HidTraceReplayReady();
+        g_DeviceDetected = MyDeviceDetected;
+        return MyDeviceDetected;
+    }
+    
     // Initialize hidapi
     hid_init();
     
@@ -132,9 +140,16 @@ void ReadHIDInputReport()
     // The first byte is the report number (0)
     InputReport[0] = 0;
     
-    if (DeviceHandle != NULL) {
-        // Read with timeout (equivalent to previous WaitForSingleObject timeout)
-        result = hid_read_timeout(DeviceHandle, (unsigned char*)InputReport, HIDREPORTNUM, 264000);
+    bool replay = HidTraceReplaying();
+    
+    if (DeviceHandle != NULL || replay) {
+        if (replay) {
+            result = HidTraceReplayRead(InputReport);
+        } else {
+            // Read with timeout (equivalent to previous WaitForSingleObject timeout)
+            result = hid_read_timeout(DeviceHandle, (unsigned char*)InputReport, HIDREPORTNUM, 264000);
+        }
+        HidTraceCapture(HIDTRACE_IN, InputReport, result);
         
         if (result > 0) {
             // Successful read
@@ -200,8 +215,16 @@ void WriteHIDOutputReport()
         OutputReport[i] = TxData[i - 1];
     }
     
-    if (DeviceHandle != NULL) {
+    if (HidTraceReplaying()) {
+        int result = HidTraceReplayWrite(OutputReport);
+        HidTraceCapture(HIDTRACE_OUT, OutputReport, result);
+        
+        if (result < 0) {
+            MyDeviceDetected = FALSE;
+        }
+    } else if (DeviceHandle != NULL) {
         int result = hid_write(DeviceHandle, (unsigned char*)OutputReport, HIDREPORTNUM);
+        HidTraceCapture(HIDTRACE_OUT, OutputReport, result);
         
         if (result < 0) {
             // Write failed
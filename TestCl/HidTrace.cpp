@@ -0,0 +1,189 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "HidTrace.h"
+#include "MonoClock.h"
+
+static FILE					*g_TraceFile = NULL;
+static uint64_t				g_TraceStart = 0;
+
+static std::vector<HidTraceRecord> g_Replay;
+static bool					g_Replaying = false;
+static int					g_ReplayMode = HIDTRACE_FAST;
+static size_t				g_ReplayPos = 0;
+static uint64_t				g_ReplayAnchor = 0;	// Host time minus trace time at the last output report
+static uint64_t				g_Mismatches = 0;
+static HidSimDevice			g_Sim;
+static bool					g_Simulating = false;
+
+// Recording and replay are independent, so a replay can itself be traced
+
+bool HidTraceStart(const char *path)
+{
+	if (g_TraceFile)
+		fclose(g_TraceFile);
+
+	g_TraceFile = fopen(path, "wb");
+	if (!g_TraceFile)
+		return false;
+
+	HidTraceHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = HIDTRACE_MAGIC;
+	h.version = HIDTRACE_VERSION;
+	h.report_bytes = HIDREPORTNUM;
+
+	if (fwrite(&h, sizeof(h), 1, g_TraceFile) != 1) {
+		fclose(g_TraceFile);
+		g_TraceFile = NULL;
+		return false;
+	}
+
+	g_TraceStart = MonoTimeNs();
+
+	return true;
+}
+
+bool HidTraceReplay(const char *path, int mode)
+{
+	g_Simulating = false;
+	g_Replaying = false;
+	g_Replay.clear();
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	HidTraceHeader h;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == HIDTRACE_MAGIC &&
+		h.version == HIDTRACE_VERSION && h.report_bytes == HIDREPORTNUM;
+
+	HidTraceRecord r;
+	while (ok && fread(&r, sizeof(r), 1, f) == 1)
+		g_Replay.push_back(r);				// A record cut short by a crash is dropped
+
+	fclose(f);
+
+	if (!ok) {
+		g_Replay.clear();
+		return false;
+	}
+
+	g_Replaying = true;
+	g_ReplayMode = mode;
+	g_ReplayPos = 0;
+	g_ReplayAnchor = MonoTimeNs();
+	g_Mismatches = 0;
+
+	return true;
+}
+
+bool HidTraceSimulate(const HidSimDevice *dev)
+{
+	g_Replaying = false;
+	g_Replay.clear();
+	g_ReplayPos = 0;
+
+	g_Simulating = dev != NULL;
+	if (dev)
+		g_Sim = *dev;
+
+	return true;
+}
+
+void HidTraceStop()
+{
+	if (g_TraceFile) {
+		fclose(g_TraceFile);
+		g_TraceFile = NULL;
+	}
+
+	g_Simulating = false;
+	g_Replaying = false;
+	g_Replay.clear();
+	g_ReplayPos = 0;
+}
+
+bool HidTraceReplaying()
+{
+	return g_Replaying || g_Simulating;
+}
+
+bool HidTraceReplayReady()
+{
+	return g_Simulating || (g_Replaying && g_ReplayPos < g_Replay.size());
+}
+
+uint64_t HidTraceRemaining()
+{
+	return g_Replay.size() - g_ReplayPos;
+}
+
+uint64_t HidTraceMismatches()
+{
+	return g_Mismatches;
+}
+
+void HidTraceCapture(int dir, const char *report, int result)
+{
+	if (!g_TraceFile)
+		return;
+
+	HidTraceRecord r;
+	memset(&r, 0, sizeof(r));
+	r.t_ns = MonoTimeNs() - g_TraceStart;
+	r.dir = dir;
+	r.result = result;
+	memcpy(r.report, report, HIDREPORTNUM);
+
+	fwrite(&r, sizeof(r), 1, g_TraceFile);
+}
+
+// The device only answers what it is asked, so output reports are matched in
+// order. Differences are counted, not fatal: a trace can still be replayed
+// after a harmless change to, say, the integration time sent.
+
+int HidTraceReplayWrite(const char *report)
+{
+	if (g_Simulating)
+		return g_Sim.write(g_Sim.ctx, report);
+
+	while (g_ReplayPos < g_Replay.size() && g_Replay[g_ReplayPos].dir != HIDTRACE_OUT)
+		g_ReplayPos++;						// Unread input, e.g. a frame the caller abandoned
+
+	if (g_ReplayPos == g_Replay.size())
+		return -1;
+
+	const HidTraceRecord &r = g_Replay[g_ReplayPos++];
+
+	if (memcmp(r.report + 1, report + 1, HIDREPORTNUM - 1))
+		g_Mismatches++;
+
+	g_ReplayAnchor = MonoTimeNs() - r.t_ns;
+
+	return r.result;
+}
+
+int HidTraceReplayRead(char *report)
+{
+	if (g_Simulating)
+		return g_Sim.read(g_Sim.ctx, report);
+
+	if (g_ReplayPos == g_Replay.size() || g_Replay[g_ReplayPos].dir != HIDTRACE_IN)
+		return 0;							// Nothing recorded for this read: same as a device timeout
+
+	const HidTraceRecord &r = g_Replay[g_ReplayPos++];
+
+	if (g_ReplayMode == HIDTRACE_REALTIME)
+		SleepUntilNs(g_ReplayAnchor + r.t_ns);
+
+	memcpy(report, r.report, HIDREPORTNUM);
+
+	return r.result;
+}
@@ -0,0 +1,66 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+
+#include "HidMgr.h"
+
+// HID traces. While tracing, every report passed to hid_write and every result
+// of hid_read_timeout (including timeouts and errors) is appended to a file
+// with its time. A trace can later stand in for the device: FindTheHID then
+// succeeds without hardware, WriteHIDOutputReport consumes the recorded output
+// reports and ReadHIDInputReport returns the recorded input reports, so trim
+// readout and frame captures run exactly as they did against the real device.
+//
+// File layout: HidTraceHeader followed by HidTraceRecord[], in call order.
+
+#define HIDTRACE_MAGIC		0x43525448		// "HTRC"
+#define HIDTRACE_VERSION	1
+
+#define HIDTRACE_OUT		0				// WriteHIDOutputReport
+#define HIDTRACE_IN			1				// ReadHIDInputReport
+
+#define HIDTRACE_REALTIME	0				// Replay input reports with their recorded latency
+#define HIDTRACE_FAST		1				// Replay as fast as the host can consume them
+
+struct HidTraceHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	report_bytes;				// HIDREPORTNUM, including the report ID
+	uint32_t	reserved;
+};
+
+struct HidTraceRecord {
+	uint64_t	t_ns;						// Since the trace was started
+	int32_t		dir;						// HIDTRACE_OUT or HIDTRACE_IN
+	int32_t		result;						// Return value of hid_write / hid_read_timeout
+	uint8_t		report[HIDREPORTNUM];
+	uint8_t		pad[7];
+};
+
+// A simulated device is driven the same way as a replayed trace, except that
+// it answers each output report itself (see SimDevice.h).
+
+struct HidSimDevice {
+	void		*ctx;
+	int			(*write)(void *ctx, const char *report);	// Returns what hid_write would
+	int			(*read)(void *ctx, char *report);			// Returns what hid_read_timeout would, 0: timeout
+};
+
+bool HidTraceStart(const char *path);		// Record all reports from now on
+bool HidTraceReplay(const char *path, int mode);	// Use the trace in place of the device
+bool HidTraceSimulate(const HidSimDevice *dev);	// Use dev in place of the device, NULL to detach
+void HidTraceStop();						// End recording, replay or simulation
+bool HidTraceReplaying();					// A trace or simulated device stands in for the device
+bool HidTraceReplayReady();					// ... and can still answer
+
+// Replay statistics
+uint64_t HidTraceRemaining();				// Records not yet replayed
+uint64_t HidTraceMismatches();				// Output reports that differ from the recorded ones
+
+// Hooks used by HidMgr
+void HidTraceCapture(int dir, const char *report, int result);
+int  HidTraceReplayWrite(const char *report);
+int  HidTraceReplayRead(char *report);
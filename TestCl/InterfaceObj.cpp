@@ -6,6 +6,7 @@
 
 #include "InterfaceObj.h"
 #include "HidMgr.h"
+#include "MonoClock.h"
 
 extern BYTE TxData[TxNum];		// the buffer of sent data to HID
 extern BYTE RxData[RxNum];		// the buffer of received data from HID
@@ -17,6 +18,8 @@ int gain_mode = 0;					// todo: move to member variable
 float int_time = 1;				// integration time
 int frame_size = 0;				// 0: 12x12 frame; 1: 24x24 frame
 
+extern int chan_num;
+
 extern BOOL Continue_Flag;
 extern BOOL ee_continue;
 
@@ -25,58 +28,181 @@ TCHAR g_CurrentDirectory[MAX_PATH];
 CInterfaceObject::CInterfaceObject()
 {
 	cur_chan = 1;
+	cur_txbin = 0x8;
+	frame_reports = 0;
+
+	for (int i = 0; i < 4; i++) {
+		m_ChanReady[i] = false;
+		m_ChanGain[i] = -1;
+		m_ChanIntTime[i] = -1;
+	}
+	memset(m_ChanTrim, 0, sizeof(m_ChanTrim));
+
+	m_CalSlot = m_CalRcu.Register();
+	m_Cal = m_CalRcu.Enter(m_CalSlot);
+	m_CalVersion = m_Cal->version;
+
+	m_IssueTime = 0;
+	m_IssueChan = 1;
+
+	memset(&frame_meta, 0, sizeof(frame_meta));
+	frame_meta.size = 12;
+
+	m_DarkEnable = true;
+	m_LedIndv = 1;
+	m_LedMask = 0;
+	for (int i = 0; i < 4; i++)
+		m_DarkCache[i].valid = false;
+
+	memset(&m_OutBuf, 0, sizeof(m_OutBuf));
+}
+
+CInterfaceObject::~CInterfaceObject()
+{
+	UnregisterBuffers();
 }
 
 CString CInterfaceObject::GetChipName()
 {
-	return m_TrimReader.Node[0].name;
+	return GetCalib()->trim.GetNode(0).name;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Below are interfaces to set ULS24 internal parameters - called trim data. 
 /////////////////////////////////////////////////////////////////////////////
 
+// Channels are programmed on first use (SelSensor, IssueCapture12) rather than
+// all four up front, so a run that uses one channel pays for one. The selected
+// channel is always a programmed one.
+
 void CInterfaceObject::ResetTrim()
 {
-	SelSensor(1);
-	SetRampgen((BYTE)m_TrimReader.Node[0].rampgen); 
-	SetRangeTrim(0x0f);
-	SetV20(m_TrimReader.Node[0].auto_v20[1]);
-	SetV15(m_TrimReader.Node[0].auto_v15);
-	SetGainMode(1);			// Low gain
-	SetTXbin(0x8);
-	SetIntTime(1);			// 1 ms
+	SyncCalib();
 
-	SelSensor(2);
-	SetRampgen((BYTE)m_TrimReader.Node[1].rampgen);
-	SetRangeTrim(0x0f);
-	SetV20(m_TrimReader.Node[1].auto_v20[1]);
-	SetV15(m_TrimReader.Node[1].auto_v15);
-	SetGainMode(1);			// Low gain
-	SetTXbin(0x8);
-	SetIntTime(1);			// 1 ms
+	for (int i = 0; i < 4; i++)
+		m_ChanReady[i] = false;
 
-	SelSensor(3);
-	SetRampgen((BYTE)m_TrimReader.Node[2].rampgen);
-	SetRangeTrim(0x0f);
-	SetV20(m_TrimReader.Node[2].auto_v20[1]);
-	SetV15(m_TrimReader.Node[2].auto_v15);
-	SetGainMode(1);			// Low gain
-	SetTXbin(0x8);
-	SetIntTime(1);			// 1 ms
+	ProgramChannel((BYTE)(cur_chan >= 1 && cur_chan <= 4 ? cur_chan : 1));
 
-	SelSensor(4);
-	SetRampgen((BYTE)m_TrimReader.Node[3].rampgen);
+	SetLEDConfig(1, 1, 1, 1, 1);			// Set Multi LED mode, first enable all channels, then disable all channels.
+	Sleep(100);								// Why do we need to do this
+	SetLEDConfig(1, 0, 0, 0, 0);
+}
+
+// Writes the channel's trim registers from the current calibration set. Leaves
+// it selected with low gain and 1 ms integration.
+
+void CInterfaceObject::ProgramChannel(BYTE chan)
+{
+	const CTrimNode &node = m_Cal->trim.GetNode(chan - 1);
+
+	m_ChanReady[chan - 1] = true;
+	m_ChanGain[chan - 1] = -1;			// Written again below
+	m_ChanIntTime[chan - 1] = -1;
+	m_ChanTrim[chan - 1].rampgen = node.rampgen;
+	m_ChanTrim[chan - 1].v20[0] = node.auto_v20[0];
+	m_ChanTrim[chan - 1].v20[1] = node.auto_v20[1];
+	m_ChanTrim[chan - 1].v15 = node.auto_v15;
+
+	WriteSelSensor(chan);
+	SetRampgen((BYTE)node.rampgen);
 	SetRangeTrim(0x0f);
-	SetV20(m_TrimReader.Node[3].auto_v20[1]);
-	SetV15(m_TrimReader.Node[3].auto_v15);
+	SetV20(node.auto_v20[1]);
+	SetV15(node.auto_v15);
 	SetGainMode(1);			// Low gain
 	SetTXbin(0x8);
 	SetIntTime(1);			// 1 ms
+}
 
-	SetLEDConfig(1, 1, 1, 1, 1);			// Set Multi LED mode, first enable all channels, then disable all channels.
-	Sleep(100);								// Why do we need to do this
-	SetLEDConfig(1, 0, 0, 0, 0);
+int CInterfaceObject::PrepareChannel(BYTE chan)
+{
+	if (chan < 1 || chan > 4 || m_ChanReady[chan - 1])
+		return 0;
+
+	int prev = cur_chan;
+	int gain = gain_mode;
+	float it = int_time;
+	int txbin = cur_txbin;
+
+	ProgramChannel(chan);
+
+	if (prev != chan) {					// The previous channel's registers are untouched
+		WriteSelSensor((BYTE)prev);
+		gain_mode = gain;
+		int_time = it;
+		cur_txbin = txbin;
+	}
+	else {								// Reprogrammed for a new calibration set, restore its settings
+		if (txbin != cur_txbin)
+			SetTXbin((BYTE)txbin);
+		if (gain != gain_mode)
+			SetGainMode(gain);
+		if (it != int_time)
+			SetIntTime(it);
+	}
+
+	return 1;
+}
+
+// Takes the current calibration set for the frame about to start. Channels
+// programmed with register values that the new set changes are programmed
+// again on their next use.
+
+void CInterfaceObject::SyncCalib()
+{
+	m_Cal = m_CalRcu.Enter(m_CalSlot);
+
+	if (m_Cal->version == m_CalVersion)
+		return;
+
+	m_CalVersion = m_Cal->version;
+
+	for (int i = 0; i < 4; i++) {
+		const CTrimNode &node = m_Cal->trim.GetNode(i);
+		const ChanTrim &t = m_ChanTrim[i];
+
+		if (t.rampgen != node.rampgen || t.v20[0] != node.auto_v20[0] || t.v20[1] != node.auto_v20[1] || t.v15 != node.auto_v15)
+			m_ChanReady[i] = false;
+	}
+}
+
+const CCalibSet *CInterfaceObject::GetCalib()
+{
+	SyncCalib();
+
+	return m_Cal;
+}
+
+uint32_t CInterfaceObject::PublishCalib(const CTrimReader &trim)
+{
+	return m_CalRcu.Update([&](CCalibSet &set) {
+		set.trim = trim;
+		set.trim.RestoreNodes();		// Decoded once here, the published copy is never written
+		return true;
+	});
+}
+
+uint32_t CInterfaceObject::PublishDarks(const CDarkLibrary &dark)
+{
+	return m_CalRcu.Update([&](CCalibSet &set) {
+		set.dark = dark;
+		return true;
+	});
+}
+
+uint32_t CInterfaceObject::ClearDarks()
+{
+	return m_CalRcu.Update([](CCalibSet &set) {
+		set.dark.Clear();
+		return true;
+	});
+}
+
+uint32_t CInterfaceObject::LoadDarks(const char *path)
+{
+	return m_CalRcu.Update([&](CCalibSet &set) {
+		return set.dark.Load(path) != 0;
+	});
 }
 
 void CInterfaceObject::SetV15(BYTE v15)
@@ -107,10 +233,12 @@ void CInterfaceObject::SetGainMode(int gain)
 	ReadHIDInputReport();
 
 	gain_mode = gain;
+	if (cur_chan >= 1 && cur_chan <= 4)
+		m_ChanGain[cur_chan - 1] = gain;
 
 	// When gain mode change, V20 needs to change also
-	if(!gain) SetV20(m_TrimReader.Node[cur_chan - 1].auto_v20[1]); // auto_v20_hg);
-	else SetV20(m_TrimReader.Node[cur_chan - 1].auto_v20[0]); // auto_v20_lg);
+	if(!gain) SetV20(m_Cal->trim.GetNode(cur_chan - 1).auto_v20[1]); // auto_v20_hg);
+	else SetV20(m_Cal->trim.GetNode(cur_chan - 1).auto_v20[0]); // auto_v20_lg);
 }
 
 void  CInterfaceObject::SetRangeTrim(BYTE range)
@@ -138,6 +266,8 @@ void  CInterfaceObject::SetTXbin(BYTE txbin)
 	WriteHIDOutputReport();		// 
 	memset(TxData,0,sizeof(TxData));
 	ReadHIDInputReport();
+
+	cur_txbin = txbin;
 }
 
 ///////////////////////////////////////////////////////
@@ -153,9 +283,21 @@ void  CInterfaceObject::SetIntTime(float it)
 	ReadHIDInputReport();
 
 	int_time = it;
+	if (cur_chan >= 1 && cur_chan <= 4)
+		m_ChanIntTime[cur_chan - 1] = it;
 }
 
 void  CInterfaceObject::SelSensor(BYTE chan)
+{
+	SyncCalib();
+
+	if (chan >= 1 && chan <= 4 && !m_ChanReady[chan - 1])
+		ProgramChannel(chan);
+	else
+		WriteSelSensor(chan);
+}
+
+void  CInterfaceObject::WriteSelSensor(BYTE chan)
 {
 	m_TrimReader.SelSensor(chan);
 
@@ -164,6 +306,28 @@ void  CInterfaceObject::SelSensor(BYTE chan)
 	ReadHIDInputReport();
 
 	cur_chan = (int)chan;
+
+	if (chan >= 1 && chan <= 4 && m_ChanGain[chan - 1] >= 0)		// The selected channel's settings
+		gain_mode = m_ChanGain[chan - 1];
+	if (chan >= 1 && chan <= 4 && m_ChanIntTime[chan - 1] >= 0)
+		int_time = m_ChanIntTime[chan - 1];
+}
+
+// Gain and integration time are per channel (see ProgramChannel), so they are
+// compared with the values last written to chan, not to the selected channel.
+
+void CInterfaceObject::ApplySettings(BYTE chan, int gain, float it, bool force)
+{
+	if (force || chan != cur_chan)
+		SelSensor(chan);
+
+	bool known = chan >= 1 && chan <= 4;
+
+	if (force || !known || gain != m_ChanGain[chan - 1])
+		SetGainMode(gain);
+
+	if (force || !known || it != m_ChanIntTime[chan - 1])
+		SetIntTime(it);
 }
 
 void  CInterfaceObject::SetLEDConfig(BOOL IndvEn, BOOL Chan1, BOOL Chan2, BOOL Chan3, BOOL Chan4)
@@ -173,56 +337,665 @@ void  CInterfaceObject::SetLEDConfig(BOOL IndvEn, BOOL Chan1, BOOL Chan2, BOOL C
 	WriteHIDOutputReport();		// 
 	memset(TxData, 0, sizeof(TxData));
 	ReadHIDInputReport();
+
+	m_LedIndv = IndvEn;
+	m_LedMask = (Chan1 ? 1 : 0) | (Chan2 ? 2 : 0) | (Chan3 ? 4 : 0) | (Chan4 ? 8 : 0);
 }
 
 void CInterfaceObject::ProcessRowData()
 {
-	frame_size = m_TrimReader.ProcessRowData(frame_data, gain_mode);
+	const int *dark = GetDarkFrame(chan_num, CTrimReader::ReportCols(RxData));
+
+	frame_size = m_Cal->trim.ProcessRowData(frame_data, gain_mode, dark);
 }
 
-int  CInterfaceObject::CaptureFrame12(BYTE chan)
+int CInterfaceObject::ProcessRowData(int *frame, int stride)
 {
-	// Issue capture command
+	const int *dark = GetDarkFrame(chan_num, CTrimReader::ReportCols(RxData));
 
-	m_TrimReader.Capture12(chan);
-	WriteHIDOutputReport();		// 
-	memset(TxData,0,sizeof(TxData));
+	return m_Cal->trim.CorrectRow(RxData, chan_num, gain_mode, frame, stride, dark);
+}
 
-	// Read and process result
+///////////////////////////////////////////////////////
+// Caller-registered output buffers
+////////////////////////////////////////////////////////
+
+int CInterfaceObject::RegisterBuffers(void *base, int count, int type, int size, size_t stride)
+{
+	size_t elem = (type == OUTBUF_UINT16) ? sizeof(uint16_t) : sizeof(int);
+	size_t frame = elem * size * size;
+
+	if (!base || count < 1 || (type != OUTBUF_INT32 && type != OUTBUF_UINT16) || (size != 12 && size != 24))
+		return 0;
+
+	if (!stride)
+		stride = frame;
+
+	if (stride < frame || stride % elem || (uintptr_t)base % elem)
+		return 0;
+
+	UnregisterBuffers();
+
+	m_OutBuf.base = (BYTE *)base;
+	m_OutBuf.count = count;
+	m_OutBuf.type = type;
+	m_OutBuf.size = size;
+	m_OutBuf.stride = stride;
+	m_OutBuf.next = 0;
+	m_OutBuf.meta = new FrameMeta[count];
+
+	memset(m_OutBuf.meta, 0, count * sizeof(FrameMeta));
+
+	return 1;
+}
+
+void CInterfaceObject::UnregisterBuffers()
+{
+	delete[] m_OutBuf.meta;
+	memset(&m_OutBuf, 0, sizeof(m_OutBuf));
+}
+
+const FrameMeta *CInterfaceObject::GetBufferMeta(int index)
+{
+	if (index < 0 || index >= m_OutBuf.count)
+		return NULL;
+
+	return &m_OutBuf.meta[index];
+}
+
+template <typename T>
+int CInterfaceObject::ReadFrameInto(T *dst, int dim)
+{
 	Continue_Flag = true;
+	frame_reports = 0;
 
-	while(Continue_Flag) {		// Process data row by row
+	while (Continue_Flag) {
 		ReadHIDInputReport();
-		ProcessRowData();
-//		((CTestBBDlg*)pDlg)->DrawPattern();
-		memset(RxData,0,sizeof(RxData));
+		frame_reports++;
+		if (!MyDeviceDetected)
+			return 1;
+
+		const int *dark = GetDarkFrame(chan_num, dim);
+		m_Cal->trim.CorrectRowT<T>(RxData, chan_num, gain_mode, dst, dim, dim, dark);
+		memset(RxData, 0, sizeof(RxData));
+	}
+
+	return 0;
+}
+
+int CInterfaceObject::CaptureInto(BYTE chan, int index)
+{
+	if (!m_OutBuf.count || chan < 1 || chan > 4 || index >= m_OutBuf.count)
+		return -1;
+
+	if (index < 0)
+		index = m_OutBuf.next;
+
+	BYTE *dst = m_OutBuf.base + index * m_OutBuf.stride;
+
+	if (m_OutBuf.size == 12)
+		IssueCapture12(chan);
+	else {
+		if (chan != cur_chan)
+			SelSensor(chan);
+		IssueCapture24();
+	}
+
+	int e = (m_OutBuf.type == OUTBUF_UINT16) ? ReadFrameInto((uint16_t *)dst, m_OutBuf.size) : ReadFrameInto((int *)dst, m_OutBuf.size);
+	if (e)
+		return -1;
+
+	FrameMeta &m = m_OutBuf.meta[index];
+	m.seq = m_OutBuf.captures++;
+	m.t_start = m_IssueTime;
+	m.t_end = MonoTimeNs();
+	m.chan = m_IssueChan;
+	m.gain = gain_mode;
+	m.int_time = int_time;
+	m.calib = m_CalVersion;
+	m.size = m_OutBuf.size;
+	m.flags = 0;
+
+	if (m_OutBuf.type == OUTBUF_UINT16) {
+		int frame[RING_FRAME_PIXELS];
+		const uint16_t *src = (const uint16_t *)dst;
+
+		for (int i = 0; i < m.size * m.size; i++)
+			frame[i] = src[i];
+
+		PostFrame(m, frame, m.size);
+	}
+	else
+		PostFrame(m, (const int *)dst, m.size);
+
+	m_OutBuf.next = (index + 1) % m_OutBuf.count;
+
+	if (m_OutBuf.size == 12)
+		RefreshFpn(chan);
+
+	return index;
+}
+
+int CInterfaceObject::CaptureFrameTo(BYTE chan, int size, int *dst, FrameMeta *meta)
+{
+	if (chan < 1 || chan > 4 || (size != 12 && size != 24))
+		return 1;
+
+	if (size == 12)
+		IssueCapture12(chan);
+	else {
+		if (chan != cur_chan)
+			SelSensor(chan);
+		IssueCapture24();
+	}
+
+	if (ReadFrameInto(dst, size))
+		return 1;
+
+	FrameMeta m;
+	m.seq = 0;
+	m.t_start = m_IssueTime;
+	m.t_end = MonoTimeNs();
+	m.chan = m_IssueChan;
+	m.gain = gain_mode;
+	m.int_time = int_time;
+	m.calib = m_CalVersion;
+	m.size = size;
+	m.flags = 0;
+
+	PostFrame(m, dst, size);
+
+	if (meta)
+		*meta = m;
+
+	return 0;
+}
+
+int CInterfaceObject::CaptureSequence(const CaptureStep *steps, int n, int *out, FrameMeta *meta)
+{
+	int k = 0;
+
+	for (int s = 0; s < n; s++) {
+		const CaptureStep &step = steps[s];
+
+		ApplySettings((BYTE)step.chan, step.gain, step.int_time);
+
+		for (int r = 0; r < step.repeats; r++, k++) {
+			IssueCapture12((BYTE)step.chan);
+
+			if (ReadFrameInto(out + k * 144, 12))
+				return k;
+
+			FrameMeta m;
+			m.seq = k;
+			m.t_start = m_IssueTime;
+			m.t_end = MonoTimeNs();
+			m.chan = step.chan;
+			m.gain = gain_mode;
+			m.int_time = int_time;
+			m.calib = m_CalVersion;
+			m.size = 12;
+			m.flags = 0;
+
+			PostFrame(m, out + k * 144, 12);
+
+			if (meta)
+				meta[k] = m;
+
+			RefreshFpn((BYTE)step.chan);
+		}
+	}
+
+	return k;
+}
+
+///////////////////////////////////////////////////////
+// Dark frame library
+////////////////////////////////////////////////////////
+
+// Returns the dark reference for the current gain and integration time, or
+// NULL if there is none. Interpolation is only redone when a setting or the
+// library changes.
+
+const int *CInterfaceObject::GetDarkFrame(int chan, int size)
+{
+	if (!m_DarkEnable || !m_Cal->dark.GetCount() || chan < 1 || chan > 4)
+		return NULL;
+
+	DarkCache &c = m_DarkCache[chan - 1];
+
+	if (!c.valid || c.version != m_CalVersion || c.gain != gain_mode || c.size != size || c.int_time != int_time) {
+		c.version = m_CalVersion;
+		c.gain = gain_mode;
+		c.size = size;
+		c.int_time = int_time;
+		c.valid = m_Cal->dark.Lookup(chan, gain_mode, size, int_time, c.data) != 0;
+	}
+
+	return c.valid ? c.data : NULL;
+}
+
+// The selected channel, the settings of it and of chan, and the LEDs are
+// restored on every path, so the next capture runs as before.
+
+int CInterfaceObject::CaptureDark(BYTE chan, int gain, float it, int navg, int size)
+{
+	int sum[DARK_MAX_PIXELS];
+	int n = size * size;
+
+	if (navg < 1 || (size != 12 && size != 24) || chan < 1 || chan > 4)
+		return 1;
+
+	int prev = cur_chan;
+	int prev_gain = gain_mode;
+	float prev_it = int_time;
+	int chan_gain = m_ChanGain[chan - 1];
+	float chan_it = m_ChanIntTime[chan - 1];
+	BOOL indv = m_LedIndv;
+	int mask = m_LedMask;
+
+	SetLEDConfig(1, 0, 0, 0, 0);		// All excitation off
+	SelSensor(chan);
+	SetGainMode(gain);
+	SetIntTime(it);
+
+	bool en = m_DarkEnable;
+	m_DarkEnable = false;				// The reference itself must not be dark corrected
+
+	memset(sum, 0, sizeof(sum));
+
+	int e = 0;
+
+	for (int k = 0; k < navg && !e; k++) {
+		e = (size == 12) ? CaptureFrame12(chan) : CaptureFrame24();
+
+		for (int i = 0; i < size && !e; i++)
+			for (int j = 0; j < size; j++)
+				sum[i * size + j] += frame_data[i][j];
 	}
 
+	m_DarkEnable = en;
+
+	if (MyDeviceDetected) {
+		if (prev != chan && chan_gain >= 0 && chan_it >= 0)
+			ApplySettings(chan, chan_gain, chan_it, true);
+		if (prev >= 1 && prev <= 4)
+			ApplySettings((BYTE)prev, prev_gain, prev_it, true);
+
+		SetLEDConfig(indv, mask & 1, mask & 2, mask & 4, mask & 8);
+	}
+
+	if (e)
+		return e;
+
+	for (int i = 0; i < n; i++)
+		sum[i] = (sum[i] + navg / 2) / navg;
+
+	m_CalRcu.Update([&](CCalibSet &set) {
+		set.dark.Add(chan, gain, size, it, sum, navg);
+		return true;
+	});
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////
+// Online FPN refresh
+////////////////////////////////////////////////////////
+
+// The LEDs are switched off with an unacknowledged command written back to
+// back with the capture, as in CaptureDiff12, and restored on every path. A
+// device error here shows up as an error of the next capture. frame_meta and
+// frame_reports keep describing the frame just returned.
+
+void CInterfaceObject::RefreshFpn(BYTE chan)
+{
+	if (!m_LedMask || !m_FpnRefresh.Tick())			// Only lit frames count, a dark stream needs no refresh
+		return;
+
+	BOOL indv = m_LedIndv;
+	int mask = m_LedMask;
+
+	int frame[TRIM_IMAGER_SIZE * TRIM_IMAGER_SIZE];
+	BYTE flags[TRIM_IMAGER_SIZE * TRIM_IMAGER_SIZE];
+
+	memset(frame, 0, sizeof(frame));
+	memset(flags, 1, sizeof(flags));				// Rows not received are not used
+
+	SyncCalib();
+	PrepareChannel(chan);							// Before any unacknowledged LED command is queued
+
+	const int *dark = GetDarkFrame(chan, TRIM_IMAGER_SIZE);
+
+	WriteLED(0);
+
+	m_TrimReader.Capture12(chan);					// Not WriteCapture12: keep the returned frame's issue time
+	WriteHIDOutputReport();
+	memset(TxData, 0, sizeof(TxData));
+
+	Continue_Flag = true;
+
+	while (Continue_Flag) {
+		ReadHIDInputReport();
+		if (!MyDeviceDetected)
+			break;
+
+		if (!CTrimReader::IsLEDAck(RxData))
+			m_Cal->trim.CorrectRowT<int>(RxData, chan, gain_mode, frame, TRIM_IMAGER_SIZE, TRIM_IMAGER_SIZE, dark, flags);
+
+		memset(RxData, 0, sizeof(RxData));
+	}
+
+	SetLEDConfig(indv, mask & 1, mask & 2, mask & 4, mask & 8);
+
+	if (!MyDeviceDetected)
+		return;
+
+	int gain = gain_mode;
+	int g = gain ? 0 : 1;							// fpn[0]: low gain, fpn[1]: high gain
+	double fpn[TRIM_IMAGER_SIZE];
+	int fpni[TRIM_IMAGER_SIZE];
+
+	if (chan > m_Cal->trim.GetNumNode() ||
+		!m_FpnRefresh.Update(chan, gain, m_Cal->trim.GetNode(chan - 1), frame, flags, TRIM_IMAGER_SIZE, fpn, fpni))
+		return;
+
+	m_CalRcu.Update([&](CCalibSet &set) {
+		if (chan > set.trim.GetNumNode())
+			return false;
+
+		CTrimNode &node = set.trim.Node[chan - 1];
+
+		if (!memcmp(node.fpni[g], fpni, sizeof(fpni)))	// No integer change, nothing to publish
+			return false;
+
+		for (int j = 0; j < TRIM_IMAGER_SIZE; j++) {
+			node.fpn[g][j] = fpn[j];
+			node.fpni[g][j] = fpni[j];
+		}
+
+		return true;
+	});
+}
+
+int CInterfaceObject::CaptureRaw12(BYTE chan, BYTE *reports, int max)
+{
+	IssueCapture12(chan);
+
+	Continue_Flag = true;
+	frame_reports = 0;
+
+	int n = 0;
+
+	while (Continue_Flag) {
+		ReadHIDInputReport();
+		frame_reports++;
+		if (!MyDeviceDetected)
+			return -1;
+
+		if (RxData[2] == GetCmd && RxData[5] < CTrimReader::ReportCols(RxData) && n < max)
+			memcpy(reports + n++ * RxNum, RxData, RxNum);
+
+		memset(RxData, 0, sizeof(RxData));
+	}
+
+	return n;
+}
+
+// The ramp at each gain ends at the first step where at least half of the
+// pixels are at full scale; longer integration adds no usable samples.
+
+int CInterfaceObject::AutoCalibrate(BYTE chan, const AutoCalPlan &plan, AutoCalResult *res)
+{
+	if (chan < 1 || chan > 4 || plan.frames < 1)
+		return 1;
+
+	int gain = gain_mode;
+	float it = int_time;
+
+	CAutoCal cal;
+	BYTE reports[MAX_IMAGE_SIZE * RxNum];
+	int e = 0;
+
+	for (int g = 1; g >= 0 && !e; g--) {		// Low gain first
+		SetLEDConfig(1, 0, 0, 0, 0);
+		SelSensor(chan);
+		SetGainMode(g);
+
+		for (int s = 0; s < plan.ndark && !e; s++) {
+			SetIntTime(plan.dark_time[s]);
+
+			for (int k = 0; k < plan.frames && !e; k++) {
+				int n = CaptureRaw12(chan, reports, MAX_IMAGE_SIZE);
+				e = n < 0;
+
+				for (int i = 0; i < n; i++)
+					cal.Add(reports + i * RxNum, g, plan.dark_time[s], true);
+			}
+		}
+
+		SetLEDConfig(1, chan == 1, chan == 2, chan == 3, chan == 4);
+
+		for (int s = 0; s < plan.nramp && !e; s++) {
+			SetIntTime(plan.ramp_time[s]);
+
+			int full = 0, pixels = 0;
+
+			for (int k = 0; k < plan.frames && !e; k++) {
+				int n = CaptureRaw12(chan, reports, MAX_IMAGE_SIZE);
+				e = n < 0;
+
+				for (int i = 0; i < n; i++) {
+					full += cal.Add(reports + i * RxNum, g, plan.ramp_time[s], false);
+					pixels += TRIM_IMAGER_SIZE;
+				}
+			}
+
+			if (full * 2 >= pixels)
+				break;
+		}
+	}
+
+	if (e)
+		return 1;
+
+	SetLEDConfig(1, 0, 0, 0, 0);
+	ApplySettings(chan, gain, it, true);
+
+	CTrimReader *trim = new CTrimReader(GetCalib()->trim);
+	if (trim->GetNumNode() < chan)
+		trim->SetNumNode(chan);
+
+	AutoCalResult r;
+	int ok = cal.Fit(trim->Node[chan - 1], &r);
+
+	if (ok)
+		PublishCalib(*trim);
+
+	delete trim;
+
+	if (res)
+		*res = r;
+
+	return ok ? 0 : 1;
+}
+
+int  CInterfaceObject::CaptureFrame12(BYTE chan)
+{
+	IssueCapture12(chan);
+
 	// Application developer can add code here to further process 
 	// the data, that is save in "adc_result[24][24]
 
-	return 0;
+	int e = ReadFrame();
+
+	if (!e)
+		RefreshFpn(chan);
+
+	return e;
 }
 
 int  CInterfaceObject::CaptureFrame24()
 {
-		// Issue capture command
+	IssueCapture24();
+
+	// Application developer can add code here to further process 
+	// the data, that is save in "adc_result[24][24]
+
+	return ReadFrame();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Split capture: the command is sent first and the rows are collected later,
+// so callers with timing requirements can control when integration starts.
+/////////////////////////////////////////////////////////////////////////////
+
+void CInterfaceObject::IssueCapture12(BYTE chan)
+{
+	SyncCalib();
+	PrepareChannel(chan);
+
+	WriteCapture12(chan);
+}
+
+void CInterfaceObject::WriteCapture12(BYTE chan)
+{
+	// Issue capture command
+
+	m_TrimReader.Capture12(chan);
+	m_IssueTime = MonoTimeNs();
+	m_IssueChan = chan;
+	WriteHIDOutputReport();		// 
+	memset(TxData,0,sizeof(TxData));
+}
+
+void CInterfaceObject::IssueCapture24()
+{
+	SyncCalib();
+	PrepareChannel((BYTE)cur_chan);
+
+	// Issue capture command
+
 	m_TrimReader.Capture24();
+	m_IssueTime = MonoTimeNs();
+	m_IssueChan = cur_chan;
 	WriteHIDOutputReport();		// 
 	memset(TxData,0,sizeof(TxData));
+}
 
+int CInterfaceObject::ReadFrame()
+{
 	// Read and process result
 	Continue_Flag = true;
+	frame_reports = 0;
 
 	while(Continue_Flag) {		// Process data row by row
 		ReadHIDInputReport();
+		frame_reports++;
+		if (!MyDeviceDetected)			// Timeout or read error, handle has been closed
+			return 1;
 		ProcessRowData();
-//		((CTestBBDlg*)pDlg)->DrawPattern();
 		memset(RxData,0,sizeof(RxData));
 	}
 
-	// Application developer can add code here to further process 
-	// the data, that is save in "adc_result[24][24]
+	CommitFrame(0);
+
+	return 0;
+}
+
+// Fill in frame_meta for the frame now in frame_data and add it to the history
+
+void CInterfaceObject::CommitFrame(int flags)
+{
+	frame_meta.t_start = m_IssueTime;
+	frame_meta.t_end = MonoTimeNs();
+	frame_meta.chan = m_IssueChan;
+	frame_meta.gain = gain_mode;
+	frame_meta.int_time = int_time;
+	frame_meta.calib = m_CalVersion;
+	frame_meta.size = frame_size ? 24 : 12;
+	frame_meta.flags = flags;
+	frame_meta.seq = PostFrame(frame_meta, &frame_data[0][0], MAX_IMAGE_SIZE);
+}
+
+// Every capture path ends here: the frame enters the history, the shared-memory
+// ring and the recording under the history's seq. Returns that seq.
+
+uint64_t CInterfaceObject::PostFrame(const FrameMeta &meta, const int *frame, int stride)
+{
+	FrameMeta m = meta;
+	m.seq = m_FrameRing.Push(m, frame, stride);
+
+	m_ShmPub.Publish(m, frame, stride);		// No-op unless publishing
+
+	if (m_Recorder.IsOpen())
+		m_Recorder.Write(m, frame, stride);
+
+	return m.seq;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Differential capture. The LED commands are written back to back with the
+// capture commands and their acknowledges are skipped while reading rows, so
+// the pair costs two frame times rather than four round trips.
+/////////////////////////////////////////////////////////////////////////////
+
+void CInterfaceObject::WriteLED(BYTE chan)
+{
+	m_TrimReader.SetLEDConfig(1, chan == 1, chan == 2, chan == 3, chan == 4);		// chan 0: all off
+
+	WriteHIDOutputReport();
+	memset(TxData, 0, sizeof(TxData));
+
+	m_LedIndv = 1;
+	m_LedMask = chan ? 1 << (chan - 1) : 0;
+}
+
+int CInterfaceObject::CaptureDiff12(BYTE chan)
+{
+	if (chan < 1 || chan > 4)
+		return 1;
+
+	SyncCalib();
+	PrepareChannel(chan);				// Before any unacknowledged LED command is queued
+
+	frame_reports = 0;
+
+	for (int pass = 0; pass < 2; pass++) {		// 0: LED on, 1: LED off
+		WriteLED(pass ? 0 : chan);
+
+		if (!pass)
+			WriteCapture12(chan);
+		else {
+			m_TrimReader.Capture12(chan);		// Keep the LED-on issue time in frame_meta
+			WriteHIDOutputReport();
+			memset(TxData, 0, sizeof(TxData));
+		}
+
+		Continue_Flag = true;
+
+		while (Continue_Flag) {
+			ReadHIDInputReport();
+			frame_reports++;
+			if (!MyDeviceDetected)
+				return 1;
+
+			if (CTrimReader::IsLEDAck(RxData)) {
+				memset(RxData, 0, sizeof(RxData));
+				continue;
+			}
+
+			if (!pass)
+				m_Cal->trim.CorrectRow(RxData, chan_num, gain_mode, &frame_data[0][0], MAX_IMAGE_SIZE);
+			else
+				m_Cal->trim.CorrectRowDiff(RxData, chan_num, gain_mode, &frame_data[0][0], MAX_IMAGE_SIZE);
+
+			memset(RxData, 0, sizeof(RxData));
+		}
+	}
+
+	frame_size = 0;
+	CommitFrame(FRAME_FLAG_DIFF);
 
 	return 0;
 }
@@ -241,28 +1014,75 @@ int  CInterfaceObject::LoadTrimFile()
 
 	if(e) {
 		m_TrimReader.Parse();
+		PublishCalib(m_TrimReader);
 	}
 
 	return e;
 }
 
-void CInterfaceObject::ReadTrimData()	// From flash
+// The readout is repeated from the first missing page until every page the
+// calibration uses has arrived intact. The device always streams to its last
+// page, so each pass reads the stream out to keep reports and commands paired.
+
+int CInterfaceObject::ReadTrimData()	// From flash
 {
+	m_TrimReader.BeginEEPROMRead();
 
-	m_TrimReader.EEPROMRead();
+	int start = 0;
 
-	WriteHIDOutputReport();		// 
-	memset(TxData, 0, sizeof(TxData));
+	for (int pass = 0; pass < EE_MAX_READS && start >= 0; pass++) {
+		m_TrimReader.EEPROMRead((BYTE)start);
 
-	while (ee_continue) {
-		ReadHIDInputReport();
-		m_TrimReader.OnEEPROMRead();
-		memset(RxData, 0, sizeof(RxData));
+		WriteHIDOutputReport();		// 
+		memset(TxData, 0, sizeof(TxData));
+
+		int more = 1;
+
+		while (more) {
+			ReadHIDInputReport();
+			if (!MyDeviceDetected)			// Timeout or read error, handle has been closed
+				return 1;
+			more = m_TrimReader.OnEEPROMRead();
+			memset(RxData, 0, sizeof(RxData));
+		}
+
+		start = m_TrimReader.EEPROMMissingPage();
 	}
 
-	m_TrimReader.ReadTrimData();
+	if (start >= 0 || !m_TrimReader.ReadTrimData())
+		return 1;
+
+	PublishCalib(m_TrimReader);
 
 	ResetTrim();	
+
+	return 0;
+}
+
+// The registers of channels whose values change are rewritten on their next
+// use (SyncCalib), so this does not touch the device.
+
+int CInterfaceObject::LoadCalibFile(const char *path)
+{
+	CTrimReader *trim = new CTrimReader;			// Too big for the stack
+	int ok = trim->LoadCalib(path);
+
+	if (ok)
+		PublishCalib(*trim);
+
+	delete trim;
+
+	return ok;
+}
+
+int CInterfaceObject::SaveCalibFile(const char *path)
+{
+	CTrimReader *trim = new CTrimReader(GetCalib()->trim);
+	int ok = trim->SaveCalib(path);
+
+	delete trim;
+
+	return ok;
 }
 
 int CInterfaceObject::IsDeviceDetected()
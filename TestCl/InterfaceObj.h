@@ -4,23 +4,108 @@
 #pragma once
 
 #include "TrimReader.h"
+#include "FrameRing.h"
+#include "DarkLibrary.h"
+#include "CalibSet.h"
+#include "AutoCal.h"
+#include "FpnRefresh.h"
+#include "ShmPublisher.h"
+#include "Recorder.h"
 
 #define MAX_IMAGE_SIZE 24
+#define EE_MAX_READS 4				// EEPROM readouts before the trim data is given up on
+
+#define OUTBUF_INT32	0			// Registered output buffer element types
+#define OUTBUF_UINT16	1
+
+struct CaptureStep {
+	int		chan;					// 1-4
+	int		gain;					// 0: high gain; 1: low gain
+	float	int_time;				// ms
+	int		repeats;				// Frames to capture with these settings
+};
 
 class CInterfaceObject {
 
 protected:
 
-	CTrimReader m_TrimReader;
+	CTrimReader m_TrimReader;			// Device commands and the EEPROM readout; correction uses m_Cal
+	CFrameRing m_FrameRing;				// History of recent frames, filled by ReadFrame
+	CShmPublisher m_ShmPub;				// Shared-memory copy of the history for other processes, if open
+	CFrameRecorder m_Recorder;			// Recording of the history to disk, if open
+
+	bool m_ChanReady[4];				// Trim registers programmed since ResetTrim, see ProgramChannel
+
+	struct ChanTrim {					// Register values a channel was programmed with
+		unsigned int rampgen, v20[2], v15;
+	} m_ChanTrim[4];
+
+	// Gain and integration time are kept by the device per channel. These are
+	// the values last written to each, -1 when not known.
+	int m_ChanGain[4];
+	float m_ChanIntTime[4];
+
+	// Calibration sets are published through m_CalRcu and may be replaced from
+	// any thread. This object is one of its readers: m_Cal is taken by
+	// SyncCalib at the start of each frame and used for the whole frame.
+
+	CCalibRcu m_CalRcu;
+	int m_CalSlot;
+	const CCalibSet *m_Cal;
+	uint32_t m_CalVersion;
+
+	uint64_t m_IssueTime;				// When the pending capture command was sent
+	int m_IssueChan;
+
+	bool m_DarkEnable;
+
+	BOOL m_LedIndv;						// LED configuration last written, see SetLEDConfig and WriteLED
+	int m_LedMask;						// Bit chan - 1 set: that channel's LED on
+	CFpnRefresh m_FpnRefresh;
+
+	struct DarkCache {					// Interpolated reference per channel, valid while the key matches
+		uint32_t version;				// Of the calibration set
+		int gain, size;
+		float int_time;
+		bool valid;
+		int data[DARK_MAX_PIXELS];
+	} m_DarkCache[4];
+
+	struct OutBufferSet {				// Caller-owned frame buffers, written directly by CaptureInto
+		BYTE *base;
+		int count;
+		int type;						// OUTBUF_xxx
+		int size;						// 12 or 24
+		size_t stride;					// Bytes between buffers
+		int next;
+		uint64_t captures;				// Running count, used as the buffer frames' seq
+		FrameMeta *meta;
+	} m_OutBuf;
+
+	template <typename T> int ReadFrameInto(T *dst, int dim);
+
+	const int *GetDarkFrame(int chan, int size);
+	void SyncCalib();
+	void CommitFrame(int flags);
+	uint64_t PostFrame(const FrameMeta &meta, const int *frame, int stride);
+	void WriteLED(BYTE chan);			// Queue an LED command without waiting for its acknowledge
+	void WriteSelSensor(BYTE chan);
+	void WriteCapture12(BYTE chan);		// The capture command alone, see IssueCapture12
+	void ProgramChannel(BYTE chan);
+	void RefreshFpn(BYTE chan);			// Interleaved dark capture when due, see SetFpnRefresh
 
 public:
 
 	int frame_data[MAX_IMAGE_SIZE][MAX_IMAGE_SIZE];				// Captured image frame data
+	FrameMeta frame_meta;										// Metadata of frame_data
+	int frame_reports;											// HID input reports consumed by the last ReadFrame
 	int cur_chan;
+	int cur_txbin;
 
 public:
 
 	CInterfaceObject();
+	~CInterfaceObject();
 
 ///////////////////////////////////////////////////////
 //  Callable functions for application developers
@@ -30,6 +115,7 @@ public:
 	void SetTXbin(BYTE txbin);			// Tx Binning pattern: 0x0 to 0xf
 	void SetIntTime(float);				// Integration time in ms: 1 to 66000
 	void SelSensor(BYTE);
+	void ApplySettings(BYTE chan, int gain, float it, bool force = false);	// Writes only the registers that differ from chan's
 
 //	BYTE GetGainMode(int);
 //	BYTE GetTXbin();
@@ -50,14 +136,76 @@ public:
 	int CaptureFrame12(/*int (*frame_data)[IMAGE_SIZE]*/BYTE chan);				// Capture a 12X12 image, 0: success; 1: error detected
 	int CaptureFrame24(/*int (*frame_data)[IMAGE_SIZE]*/);				// Capture a 24X24 image, 0: success; 1: error detected
 
+	void IssueCapture12(BYTE chan);		// Send the 12X12 capture command only, integration starts on receipt
+	void IssueCapture24();				// Send the 24X24 capture command only
+	int  ReadFrame();					// Collect the rows of an issued capture, 0: success; 1: error detected
+
+	// Excitation on minus excitation off, result in frame_data (signed, flagged FRAME_FLAG_DIFF), 0: success
+	int  CaptureDiff12(BYTE chan);
+
+	// Caller-registered output buffers: count frames of size x size elements, row-major,
+	// stride bytes apart (0: contiguous). Captures into them bypass frame_data and the history.
+	int  RegisterBuffers(void *base, int count, int type, int size, size_t stride);
+	void UnregisterBuffers();
+	int  CaptureInto(BYTE chan, int index);		// index < 0: next in turn. Returns the buffer index, -1 on error
+	int  CaptureFrameTo(BYTE chan, int size, int *dst, FrameMeta *meta);	// One frame into dst (size x size), 0: success
+	const FrameMeta *GetBufferMeta(int index);
+
+	// Runs n steps of 12x12 captures, corrected straight into out (144 ints per
+	// frame). meta may be NULL. Returns the number of frames captured.
+	int  CaptureSequence(const CaptureStep *steps, int n, int *out, FrameMeta *meta);
+
+	CFrameRing &GetFrameRing() { return m_FrameRing; }
+	CShmPublisher &GetPublisher() { return m_ShmPub; }
+	CFrameRecorder &GetRecorder() { return m_Recorder; }
+
+	void EnableDarkCorrection(bool en) { m_DarkEnable = en; }
+	int  CaptureDark(BYTE chan, int gain, float it, int navg, int size = 12);	// Average navg frames with LEDs off into the library, settings restored. 0: success
+
+	// Online FPN refresh (FpnRefresh.h): after every period-th 12x12 frame taken
+	// with an LED on by CaptureFrame12, CaptureInto or CaptureSequence, one
+	// dark frame of the same channel and settings is captured, not returned or
+	// added to the history, and the channel's FPN is published as a new
+	// calibration version. Timed and melt acquisitions are not interleaved.
+	// period 0: off. alpha: weight of each dark frame, 0-1.
+	void SetFpnRefresh(int period, double alpha) { m_FpnRefresh.Configure(period, alpha); }
+	int  GetFpnUpdates() const { return m_FpnRefresh.GetUpdates(); }
+
+	// Uncorrected row reports of one 12x12 capture, RxNum bytes each in the
+	// order received. Not added to the history. Returns the number of rows, -1 on error.
+	int  CaptureRaw12(BYTE chan, BYTE *reports, int max);
+
+	// Runs plan's dark and LED ramp sweeps on chan at both gains, fits its kb
+	// and FPN (AutoCal.h) and publishes them as the channel's trim. Gain and
+	// integration time are restored, the LEDs are left off. res may be NULL.
+	// 0: success; 1: device error or a column could not be fitted, nothing published
+	int  AutoCalibrate(BYTE chan, const AutoCalPlan &plan, AutoCalResult *res);
+
 //	void DrawImage(int (*frame_data)[IMAGE_SIZE], int contrast);	// Display image in GUI, contrast range 1-10
 
 	void ProcessRowData();
+	int  ProcessRowData(int *frame, int stride);		// Correct the current row report into a caller's buffer
 	int LoadTrimFile();
-	void ResetTrim();
-
-
-	void ReadTrimData();	// From flash
+	void ResetTrim();					// Programs the selected channel, the others on first use
+	int  PrepareChannel(BYTE chan);		// Program chan now if it is not yet, keeping the selection. 1: programmed
+	bool IsChannelReady(BYTE chan) { return chan >= 1 && chan <= 4 && m_ChanReady[chan - 1]; }
+
+
+	int  ReadTrimData();	// From flash, 0: success, 1: device error or pages still bad after EE_MAX_READS readouts
+	int  GetEEPROMErrors() { return m_TrimReader.GetEEPROMErrors(); }
+	int  LoadCalibFile(const char *path);	// Compiled calibration instead of flash, 1: success
+	int  SaveCalibFile(const char *path);
+
+	// Calibration sets. Publishing functions may be called from any thread,
+	// also during a capture; frames started afterwards use the new set.
+	// GetCalib and the other readers run with the device operations.
+
+	uint32_t PublishCalib(const CTrimReader &trim);		// New trim, keeps the darks. Returns the version
+	uint32_t PublishDarks(const CDarkLibrary &dark);	// New dark library, keeps the trim
+	uint32_t ClearDarks();
+	uint32_t LoadDarks(const char *path);				// 0 if the file cannot be read
+	const CCalibSet *GetCalib();						// Current set, valid until the next frame
+	uint32_t GetCalibVersion() { return m_CalRcu.GetVersion(); }
 
 	int IsDeviceDetected();				// 0: Device not detected; 1: device detected. 
 	CString	GetChipName();				// Get the name of the chip embedded in trim.dat file
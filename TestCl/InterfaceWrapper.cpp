@@ -1,27 +1,95 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
+#include <mutex>
 #include "HidMgr.h"
 #include "InterfaceObj.h"
+#include "InterfaceWrapper.h"
+#include "AcqScheduler.h"
+#include "MeltAcq.h"
+#include "AsyncCapture.h"
+#include "MonoClock.h"
+#include "Recorder.h"
+#include "HidTrace.h"
 
 // Exported C interface for use in other languages
 extern "C" {
 
 // Global interface object
 static CInterfaceObject* g_InterfaceObj = nullptr;
+static CMeltAcq* g_MeltAcq = nullptr;
+static CAsyncCapture* g_AsyncCapture = nullptr;
+
+// Serializes device access between callers and the async worker thread
+static std::recursive_mutex g_DeviceLock;
+
+// Held by Initialize and Cleanup while they replace g_InterfaceObj, and by the
+// calls that publish calibration without g_DeviceLock, so those never wait for
+// a capture but never see the object deleted. Taken before g_DeviceLock.
+static std::mutex g_LifeLock;
+
+// Serializes Initialize and Cleanup as a whole, including stopping the async
+// worker. Taken first; completion callbacks never take it.
+static std::mutex g_InitLock;
+
+// Guards g_AsyncCapture. The Async calls hold it while they use the object,
+// none of which blocks on the worker, so StopAsync can take the object out
+// and join the worker without it.
+static std::mutex g_AsyncLock;
+
+// Initialize and Cleanup join the worker, which a completion callback runs on
+static bool InAsyncCallback() {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    return g_AsyncCapture && g_AsyncCapture->IsWorkerThread();
+}
+
+// The async worker takes g_DeviceLock and g_LifeLock, so it is stopped before
+// either is held here. Called with g_InitLock held.
+static void StopAsync() {
+    CAsyncCapture* async;
+
+    {
+        std::lock_guard<std::mutex> lock(g_AsyncLock);
+        async = g_AsyncCapture;
+        g_AsyncCapture = nullptr;
+    }
+
+    delete async;
+}
 
 // Initialize the device interface
 int ULS24_Initialize() {
+    if (InAsyncCallback()) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> init(g_InitLock);
+
+    StopAsync();
+
+    std::lock_guard<std::mutex> life(g_LifeLock);
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (g_InterfaceObj) {
+        delete g_MeltAcq;
         delete g_InterfaceObj;
     }
     
     g_InterfaceObj = new CInterfaceObject();
+    g_MeltAcq = new CMeltAcq(g_InterfaceObj);
+
+    {
+        std::lock_guard<std::mutex> async(g_AsyncLock);
+        g_AsyncCapture = new CAsyncCapture(g_InterfaceObj, &g_DeviceLock);
+    }
     
     // Find the device
     bool deviceFound = FindTheHID();
     if (deviceFound) {
-        g_InterfaceObj->ReadTrimData();
-        g_InterfaceObj->ResetTrim();
+        if (g_InterfaceObj->ReadTrimData()) {       // Also resets the trim
+            return 0;               // Calibration could not be read intact
+        }
         
         g_InterfaceObj->SelSensor(1);
         g_InterfaceObj->SetIntTime(30);
@@ -35,7 +103,20 @@ int ULS24_Initialize() {
 
 // Close the device interface
 void ULS24_Cleanup() {
+    if (InAsyncCallback()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> init(g_InitLock);
+
+    StopAsync();
+
+    std::lock_guard<std::mutex> life(g_LifeLock);
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (g_InterfaceObj) {
+        delete g_MeltAcq;
+        g_MeltAcq = nullptr;
         delete g_InterfaceObj;
         g_InterfaceObj = nullptr;
     }
@@ -45,6 +126,8 @@ void ULS24_Cleanup() {
 
 // Select sensor channel (1-4)
 int ULS24_SelectChannel(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (!g_InterfaceObj || channel < 1 || channel > 4) {
         return 0;
     }
@@ -55,6 +138,8 @@ int ULS24_SelectChannel(int channel) {
 
 // Set integration time in milliseconds
 int ULS24_SetIntegrationTime(int time_ms) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (!g_InterfaceObj || time_ms < 1 || time_ms > 66000) {
         return 0;
     }
@@ -65,6 +150,8 @@ int ULS24_SetIntegrationTime(int time_ms) {
 
 // Set gain mode (0=high, 1=low)
 int ULS24_SetGainMode(int gain) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (!g_InterfaceObj || (gain != 0 && gain != 1)) {
         return 0;
     }
@@ -75,6 +162,8 @@ int ULS24_SetGainMode(int gain) {
 
 // Capture frame from specified channel
 int ULS24_CaptureFrame(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (!g_InterfaceObj || channel < 1 || channel > 4) {
         return 0;
     }
@@ -83,16 +172,79 @@ int ULS24_CaptureFrame(int channel) {
     return (result == 0) ? 1 : 0;
 }
 
-// Get frame data
+// Capture a 24x24 frame from specified channel
+int ULS24_CaptureFrame24(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4) {
+        return 0;
+    }
+
+    if (channel != g_InterfaceObj->cur_chan) {
+        g_InterfaceObj->SelSensor(channel);
+    }
+
+    int result = g_InterfaceObj->CaptureFrame24();
+    return (result == 0) ? 1 : 0;
+}
+
+// Set TX binning pattern (0x0-0xf)
+int ULS24_SetTXBin(int pattern) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || pattern < 0 || pattern > 0xf) {
+        return 0;
+    }
+
+    g_InterfaceObj->SetTXbin((BYTE)pattern);
+    return 1;
+}
+
+// Ambient-rejected capture: excitation on minus excitation off
+int ULS24_CaptureDifferential(int channel, int* diff) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4) {
+        return 0;
+    }
+
+    if (g_InterfaceObj->CaptureDiff12(channel)) {
+        return 0;
+    }
+
+    if (diff) {
+        for (int i = 0; i < 12; i++) {
+            for (int j = 0; j < 12; j++) {
+                diff[i * 12 + j] = g_InterfaceObj->frame_data[i][j];
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Dimension of the last captured frame (12 or 24)
+int ULS24_GetFrameSize() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->frame_meta.size;
+}
+
+// Get frame data, frame_data must hold 24*24 ints
 int ULS24_GetFrameData(int* frame_data, int* frame_size) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     if (!g_InterfaceObj || !frame_data || !frame_size) {
         return 0;
     }
-    
-    extern int frame_size; // Global from InterfaceObj.cpp
-    *frame_size = frame_size ? 24 : 12;
-    
-    int dim = *frame_size;
+
+    int dim = g_InterfaceObj->frame_meta.size;
+    *frame_size = dim;
+
     for (int i = 0; i < dim; i++) {
         for (int j = 0; j < dim; j++) {
             frame_data[i * dim + j] = g_InterfaceObj->frame_data[i][j];
@@ -102,10 +254,784 @@ int ULS24_GetFrameData(int* frame_data, int* frame_size) {
     return 1;
 }
 
+// Measure sustained capture rate for one resolution / binning combination
+int ULS24_ProfileMode(int size, int txbin, int frames, ULS24_ModeProfile* profile) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !profile || (size != 12 && size != 24) || txbin > 0xf || frames < 1) {
+        return 0;
+    }
+
+    int prev_txbin = g_InterfaceObj->cur_txbin;
+    if (txbin >= 0 && txbin != prev_txbin) {
+        g_InterfaceObj->SetTXbin((BYTE)txbin);
+    }
+
+    int chan = g_InterfaceObj->cur_chan;
+    int reports = 0, done = 0;
+    double lat_sum = 0, lat_min = 1e30, lat_max = 0;
+
+    uint64_t t0 = MonoTimeNs();
+
+    for (; done < frames; done++) {
+        int e = (size == 12) ? g_InterfaceObj->CaptureFrame12(chan) : g_InterfaceObj->CaptureFrame24();
+        if (e) {
+            break;
+        }
+
+        double lat = (double)(g_InterfaceObj->frame_meta.t_end - g_InterfaceObj->frame_meta.t_start) / 1e6;
+        lat_sum += lat;
+        if (lat < lat_min) lat_min = lat;
+        if (lat > lat_max) lat_max = lat;
+        reports += g_InterfaceObj->frame_reports;
+    }
+
+    double elapsed = (double)(MonoTimeNs() - t0) / 1e9;
+
+    if (txbin >= 0 && txbin != prev_txbin) {
+        g_InterfaceObj->SetTXbin((BYTE)prev_txbin);
+    }
+
+    profile->size = size;
+    profile->txbin = txbin >= 0 ? txbin : prev_txbin;
+    profile->frames = done;
+    profile->frames_per_s = (done && elapsed > 0) ? done / elapsed : 0;
+    profile->reports_per_frame = done ? (double)reports / done : 0;
+    profile->mean_latency_ms = done ? lat_sum / done : 0;
+    profile->min_latency_ms = done ? lat_min : 0;
+    profile->max_latency_ms = lat_max;
+    profile->overhead_ms = done ? profile->mean_latency_ms - g_InterfaceObj->frame_meta.int_time : 0;
+
+    return (done == frames) ? 1 : 0;
+}
+
+int ULS24_SaveCalibration(const char* path) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !path) {
+        return 0;
+    }
+
+    return g_InterfaceObj->SaveCalibFile(path);
+}
+
+// Not under g_DeviceLock: the new set is published while captures go on
+int ULS24_LoadCalibration(const char* path) {
+    std::lock_guard<std::mutex> life(g_LifeLock);
+
+    if (!g_InterfaceObj || !path) {
+        return 0;
+    }
+
+    return g_InterfaceObj->LoadCalibFile(path);
+}
+
+uint32_t ULS24_CalibVersion() {
+    std::lock_guard<std::mutex> life(g_LifeLock);
+
+    return g_InterfaceObj ? g_InterfaceObj->GetCalibVersion() : 0;
+}
+
 // Reset device connection
 int ULS24_Reset() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
     bool deviceFound = FindTheHID();
     return deviceFound ? 1 : 0;
 }
 
+uint64_t ULS24_MonotonicNs() {
+    return MonoTimeNs();
+}
+
+// Copies each scheduled 12x12 frame into the caller's array as it completes;
+// a failed job leaves zeros rather than the previous frame
+static void ScheduleFrameCallback(int job, const AcqJobResult* res, CInterfaceObject* obj, void* user) {
+    int* frames = (int*)user;
+    int* dst = frames + job * 144;
+
+    if (res->error) {
+        memset(dst, 0, 144 * sizeof(int));
+        return;
+    }
+
+    for (int i = 0; i < 12; i++) {
+        for (int j = 0; j < 12; j++) {
+            dst[i * 12 + j] = obj->frame_data[i][j];
+        }
+    }
+}
+
+// Run a timeline of captures
+int ULS24_RunSchedule(const ULS24_SchedJob* jobs, int n, uint64_t epoch_ns,
+                      int* frames, ULS24_SchedResult* results, ULS24_SchedStats* stats) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !jobs || n <= 0) {
+        return 0;
+    }
+
+    CAcqScheduler sched(g_InterfaceObj);
+
+    if (!epoch_ns) {
+        epoch_ns = MonoTimeNs() + sched.GetSetupLead();
+    }
+
+    std::vector<AcqJob> timeline(n);
+    for (int i = 0; i < n; i++) {
+        if (jobs[i].channel < 1 || jobs[i].channel > 4 || (jobs[i].gain != 0 && jobs[i].gain != 1) ||
+            jobs[i].int_time_ms < 1 || jobs[i].int_time_ms > 66000 || jobs[i].t_ms < 0) {
+            return 0;
+        }
+        if (i && jobs[i].t_ms < jobs[i - 1].t_ms) {
+            return 0;
+        }
+
+        timeline[i].chan = jobs[i].channel;
+        timeline[i].gain = jobs[i].gain;
+        timeline[i].int_time = jobs[i].int_time_ms;
+        timeline[i].t_start = epoch_ns + (uint64_t)(jobs[i].t_ms * 1e6);
+    }
+
+    std::vector<AcqJobResult> res(n);
+    AcqStats st;
+
+    sched.Run(&timeline[0], n, &res[0], &st, frames ? ScheduleFrameCallback : NULL, frames);
+
+    if (results) {
+        for (int i = 0; i < st.jobs; i++) {
+            results[i].start_ms = ((double)res[i].t_issue - (double)epoch_ns) / 1e6;
+            results[i].jitter_us = (double)res[i].jitter / 1000.0;
+            results[i].overrun = res[i].overrun;
+            results[i].error = res[i].error;
+        }
+    }
+
+    if (stats) {
+        stats->jobs = st.jobs;
+        stats->overruns = st.overruns;
+        stats->errors = st.errors;
+        stats->mean_jitter_us = st.mean_jitter_us;
+        stats->rms_jitter_us = st.rms_jitter_us;
+        stats->max_abs_jitter_us = st.max_abs_jitter_us;
+        stats->setup_lead_us = st.setup_lead_us;
+    }
+
+    return (st.jobs == n && !st.errors) ? 1 : 0;
+}
+
+static void CopyFrameMeta(ULS24_FrameMeta* dst, const FrameMeta& src) {
+    dst->seq = src.seq;
+    dst->t_start_ns = src.t_start;
+    dst->t_end_ns = src.t_end;
+    dst->channel = src.chan;
+    dst->gain = src.gain;
+    dst->int_time_ms = src.int_time;
+    dst->size = src.size;
+    dst->flags = src.flags;
+    dst->calib = src.calib;
+}
+
+// Resize the frame history, discarding its contents
+int ULS24_HistorySetCapacity(int frames) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || frames < 2) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetFrameRing().SetCapacity(frames);
+}
+
+// Oldest and newest sequence numbers still in the history
+int ULS24_HistoryRange(uint64_t* first, uint64_t* last) {
+    if (!g_InterfaceObj || !first || !last) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetFrameRing().GetRange(first, last);
+}
+
+// Frames whose capture started in [t0_ns, t1_ns)
+int ULS24_HistoryFindTime(uint64_t t0_ns, uint64_t t1_ns, uint64_t* first, uint64_t* last) {
+    if (!g_InterfaceObj || !first || !last) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetFrameRing().FindTime(t0_ns, t1_ns, first, last);
+}
+
+// Zero-copy access to a frame in the history
+int ULS24_HistoryPeek(uint64_t seq, ULS24_FrameMeta* meta, const int** data) {
+    if (!g_InterfaceObj || !data) {
+        return 0;
+    }
+
+    CFrameRing& ring = g_InterfaceObj->GetFrameRing();
+    const FrameSlot* slot = ring.Peek(seq);
+    if (!slot) {
+        return 0;
+    }
+
+    if (meta) {
+        CopyFrameMeta(meta, slot->meta);
+    }
+    *data = slot->data;
+
+    return ring.Validate(slot, seq) ? 1 : 0;
+}
+
+// Check that a peeked frame was not overwritten while it was being read
+int ULS24_HistoryValid(uint64_t seq) {
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    CFrameRing& ring = g_InterfaceObj->GetFrameRing();
+    const FrameSlot* slot = ring.Peek(seq);
+
+    return (slot && ring.Validate(slot, seq)) ? 1 : 0;
+}
+
+// Consistent copy of a frame in the history
+int ULS24_HistoryCopy(uint64_t seq, ULS24_FrameMeta* meta, int* data) {
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    FrameMeta m;
+    if (!g_InterfaceObj->GetFrameRing().Copy(seq, &m, data)) {
+        return 0;
+    }
+
+    if (meta) {
+        CopyFrameMeta(meta, m);
+    }
+
+    return 1;
+}
+
+// Pin channel configuration for melt acquisition
+int ULS24_MeltConfigure(const int* channels, int nchan, int gain, float int_time_ms) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !channels || (gain != 0 && gain != 1) || int_time_ms < 1 || int_time_ms > 66000) {
+        return 0;
+    }
+
+    return g_MeltAcq->Configure(channels, nchan, gain, int_time_ms);
+}
+
+// Stream melt frames into preallocated buffers
+int ULS24_MeltRun(int frames, int* series, ULS24_MeltSample* samples, ULS24_TempCallback temp_cb, void* user) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !series || !samples || frames < 1) {
+        return 0;
+    }
+
+    std::vector<MeltSample> s(frames);
+
+    g_MeltAcq->SetTempSource(temp_cb, user);
+    int n = g_MeltAcq->Run(frames, series, &s[0]);
+    g_MeltAcq->SetTempSource(NULL, NULL);
+
+    for (int i = 0; i < n; i++) {
+        samples[i].seq = s[i].seq;
+        samples[i].t_ns = s[i].t_issue;
+        samples[i].t_end_ns = s[i].t_end;
+        samples[i].temp = s[i].temp;
+        samples[i].channel = s[i].chan;
+    }
+
+    return n;
+}
+
+// Ask a running melt acquisition to stop after the frame in flight
+void ULS24_MeltStop() {
+    if (g_MeltAcq) {
+        g_MeltAcq->Stop();
+    }
+}
+
+// Capture and store a dark reference
+int ULS24_DarkCapture(int channel, int gain, float int_time_ms, int navg, int size) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4 || (gain != 0 && gain != 1) ||
+        int_time_ms < 1 || int_time_ms > 66000 || navg < 1 || (size != 12 && size != 24)) {
+        return 0;
+    }
+
+    int result = g_InterfaceObj->CaptureDark(channel, gain, int_time_ms, navg, size);
+    return (result == 0) ? 1 : 0;
+}
+
+// Turn dark subtraction on or off
+int ULS24_DarkEnable(int enable) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    g_InterfaceObj->EnableDarkCorrection(enable != 0);
+    return 1;
+}
+
+// Number of stored dark references
+int ULS24_DarkCount() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetCalib()->dark.GetCount();
+}
+
+// Remove all dark references, published like a calibration load
+int ULS24_DarkClear() {
+    std::lock_guard<std::mutex> life(g_LifeLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->ClearDarks() != 0;
+}
+
+// Save the dark library to a file
+int ULS24_DarkSave(const char* path) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !path) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetCalib()->dark.Save(path);
+}
+
+// Load dark references from a file, published like a calibration load
+int ULS24_DarkLoad(const char* path) {
+    std::lock_guard<std::mutex> life(g_LifeLock);
+
+    if (!g_InterfaceObj || !path) {
+        return 0;
+    }
+
+    return g_InterfaceObj->LoadDarks(path) != 0;
+}
+
+// Fit and publish one channel's trim from sweep captures
+int ULS24_AutoCalibrate(int channel, int frames, double* rms) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4 || frames < 0) {
+        return 0;
+    }
+
+    AutoCalPlan plan;
+    AutoCalDefaultPlan(&plan);
+    if (frames) {
+        plan.frames = frames;
+    }
+
+    AutoCalResult res;
+    memset(&res, 0, sizeof(res));
+    int result = g_InterfaceObj->AutoCalibrate(channel, plan, &res);
+
+    if (rms) {
+        for (int i = 0; i < TRIM_IMAGER_SIZE; i++) {
+            rms[i] = res.rms[i];
+        }
+    }
+
+    return (result == 0) ? 1 : 0;
+}
+
+// Interleave dark frames and track the FPN
+int ULS24_FpnRefresh(int period, double alpha) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || period < 0 || alpha < 0 || alpha > 1) {
+        return 0;
+    }
+
+    g_InterfaceObj->SetFpnRefresh(period, alpha);
+    return 1;
+}
+
+int ULS24_FpnRefreshCount() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetFpnUpdates();
+}
+
+// Capture one frame directly into the caller's memory
+int ULS24_CaptureFrameInto(int channel, int size, int* dst, ULS24_FrameMeta* meta) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4 || (size != 12 && size != 24) || !dst) {
+        return 0;
+    }
+
+    FrameMeta m;
+    if (g_InterfaceObj->CaptureFrameTo(channel, size, dst, &m)) {
+        return 0;
+    }
+
+    if (meta) {
+        CopyFrameMeta(meta, m);
+    }
+
+    return 1;
+}
+
+// Register caller-owned frame buffers
+int ULS24_RegisterBuffers(void* base, int count, int type, int size, size_t stride_bytes) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->RegisterBuffers(base, count, type, size, stride_bytes);
+}
+
+// Forget registered buffers; the caller may free them afterwards
+int ULS24_UnregisterBuffers() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    g_InterfaceObj->UnregisterBuffers();
+    return 1;
+}
+
+// Capture straight into a registered buffer
+int ULS24_CaptureToBuffer(int channel, int index) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || channel < 1 || channel > 4) {
+        return -1;
+    }
+
+    return g_InterfaceObj->CaptureInto(channel, index);
+}
+
+// Metadata of the frame last written to a registered buffer
+int ULS24_GetBufferMeta(int index, ULS24_FrameMeta* meta) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !meta) {
+        return 0;
+    }
+
+    const FrameMeta* m = g_InterfaceObj->GetBufferMeta(index);
+    if (!m) {
+        return 0;
+    }
+
+    CopyFrameMeta(meta, *m);
+    return 1;
+}
+
+// Run a list of capture steps in one call
+int ULS24_CaptureSequence(const ULS24_Step* steps, int n, int* out, ULS24_FrameMeta* meta) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj || !steps || n < 1 || !out) {
+        return -1;
+    }
+
+    std::vector<CaptureStep> seq(n);
+    int total = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (steps[i].channel < 1 || steps[i].channel > 4 || (steps[i].gain != 0 && steps[i].gain != 1) ||
+            steps[i].int_time_ms < 1 || steps[i].int_time_ms > 66000 || steps[i].repeats < 1) {
+            return -1;
+        }
+
+        seq[i].chan = steps[i].channel;
+        seq[i].gain = steps[i].gain;
+        seq[i].int_time = steps[i].int_time_ms;
+        seq[i].repeats = steps[i].repeats;
+        total += steps[i].repeats;
+    }
+
+    std::vector<FrameMeta> m(meta ? total : 0);
+    int done = g_InterfaceObj->CaptureSequence(&seq[0], n, out, meta ? &m[0] : NULL);
+
+    for (int i = 0; meta && i < done; i++) {
+        CopyFrameMeta(&meta[i], m[i]);
+    }
+
+    return done;
+}
+
+// Queue an operation on the async worker
+static int SubmitAsync(int op, int channel, int ival, float fval, ULS24_CompletionCallback cb, void* user) {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    if (!g_AsyncCapture) {
+        return 0;
+    }
+
+    return g_AsyncCapture->Submit(op, channel, ival, fval, cb, user);
+}
+
+// Start a capture without blocking
+int ULS24_CaptureAsync(int channel, int size, ULS24_CompletionCallback cb, void* user) {
+    if (channel < 1 || channel > 4 || (size != 12 && size != 24)) {
+        return 0;
+    }
+
+    return SubmitAsync(size == 12 ? ASYNC_OP_CAPTURE12 : ASYNC_OP_CAPTURE24, channel, 0, 0, cb, user);
+}
+
+// Start a differential capture without blocking
+int ULS24_CaptureDifferentialAsync(int channel, ULS24_CompletionCallback cb, void* user) {
+    if (channel < 1 || channel > 4) {
+        return 0;
+    }
+
+    return SubmitAsync(ASYNC_OP_DIFF12, channel, 0, 0, cb, user);
+}
+
+// Queue a channel change behind earlier async requests
+int ULS24_SelectChannelAsync(int channel, ULS24_CompletionCallback cb, void* user) {
+    if (channel < 1 || channel > 4) {
+        return 0;
+    }
+
+    return SubmitAsync(ASYNC_OP_SELCHAN, channel, 0, 0, cb, user);
+}
+
+// Queue a gain change behind earlier async requests
+int ULS24_SetGainModeAsync(int gain, ULS24_CompletionCallback cb, void* user) {
+    if (gain != 0 && gain != 1) {
+        return 0;
+    }
+
+    return SubmitAsync(ASYNC_OP_SETGAIN, 0, gain, 0, cb, user);
+}
+
+// Queue an integration time change behind earlier async requests
+int ULS24_SetIntegrationTimeAsync(float time_ms, ULS24_CompletionCallback cb, void* user) {
+    if (time_ms < 1 || time_ms > 66000) {
+        return 0;
+    }
+
+    return SubmitAsync(ASYNC_OP_SETINTTIME, 0, 0, time_ms, cb, user);
+}
+
+// Program channels' trim on the worker before their first use. One request
+// per channel, so synchronous calls can run in between. Requests already
+// queued stay queued if a later submit fails; the count tells which.
+int ULS24_PrepareChannelsAsync(int channel_mask, ULS24_CompletionCallback cb, void* user) {
+    int submitted = 0;
+
+    for (int chan = 1; chan <= 4; chan++) {
+        if (!(channel_mask & (1 << (chan - 1)))) {
+            continue;
+        }
+
+        if (!SubmitAsync(ASYNC_OP_PREPARE, chan, 0, 0, cb, user)) {
+            break;
+        }
+
+        submitted++;
+    }
+
+    return submitted;
+}
+
+// eventfd that is readable whenever a request has completed
+int ULS24_AsyncEventFd() {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    return g_AsyncCapture ? g_AsyncCapture->GetEventFd() : -1;
+}
+
+// Ids of requests completed since the last call
+int ULS24_AsyncPoll(int* ids, int max) {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    if (!g_AsyncCapture || !ids || max < 1) {
+        return 0;
+    }
+
+    return g_AsyncCapture->PollCompleted(ids, max);
+}
+
+// State of a request
+int ULS24_AsyncStatus(int id) {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    if (!g_AsyncCapture) {
+        return ULS24_ASYNC_UNKNOWN;
+    }
+
+    return g_AsyncCapture->GetStatus(id);
+}
+
+// Fetch the result of a finished request and release it
+int ULS24_AsyncResult(int id, ULS24_FrameMeta* meta, int* frame) {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    if (!g_AsyncCapture) {
+        return ULS24_ASYNC_UNKNOWN;
+    }
+
+    FrameMeta m;
+    int status = g_AsyncCapture->Collect(id, &m, frame);
+
+    if (meta && (status == ASYNC_DONE || status == ASYNC_FAILED)) {
+        CopyFrameMeta(meta, m);
+    }
+
+    return status;
+}
+
+// Release a finished request without fetching its result
+int ULS24_AsyncRelease(int id) {
+    std::lock_guard<std::mutex> lock(g_AsyncLock);
+
+    if (!g_AsyncCapture) {
+        return 0;
+    }
+
+    return g_AsyncCapture->Release(id);
+}
+
+// Start mirroring frames into shared memory for other processes
+int ULS24_PublishStart(const char* name, int slots) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetPublisher().Open(name, slots ? slots : SHM_DEFAULT_SLOTS);
+}
+
+int ULS24_PublishStop() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    g_InterfaceObj->GetPublisher().Close();
+
+    return 1;
+}
+
+// Start appending every frame to a segmented recording
+int ULS24_RecordStart(const char* prefix, int frames_per_segment) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetRecorder().Open(prefix, frames_per_segment ? frames_per_segment : REC_DEFAULT_FRAMES);
+}
+
+int ULS24_RecordStop() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    if (!g_InterfaceObj) {
+        return 0;
+    }
+
+    return g_InterfaceObj->GetRecorder().Close();
+}
+
+// Recording readers are independent of the device
+struct ULS24_Recording {
+    CRecordingReader reader;
+};
+
+ULS24_Recording* ULS24_RecOpen(const char* prefix) {
+    ULS24_Recording* rec = new ULS24_Recording;
+
+    if (!rec->reader.Open(prefix)) {
+        delete rec;
+        return nullptr;
+    }
+
+    return rec;
+}
+
+void ULS24_RecClose(ULS24_Recording* rec) {
+    delete rec;
+}
+
+uint64_t ULS24_RecCount(ULS24_Recording* rec) {
+    return rec ? rec->reader.GetCount() : 0;
+}
+
+int ULS24_RecGet(ULS24_Recording* rec, uint64_t n, ULS24_FrameMeta* meta, const int** data) {
+    const FrameRecord* r = rec ? rec->reader.Get(n) : nullptr;
+
+    if (!r) {
+        return 0;
+    }
+
+    if (meta) {
+        meta->seq = r->seq;
+        meta->t_start_ns = r->t_start;
+        meta->t_end_ns = r->t_end;
+        meta->channel = r->chan;
+        meta->gain = r->gain;
+        meta->int_time_ms = r->int_time;
+        meta->size = r->size;
+        meta->flags = r->flags;
+        meta->calib = r->calib;             // 0 in version 1 recordings
+    }
+
+    if (data) {
+        *data = r->data;
+    }
+
+    return 1;
+}
+
+uint64_t ULS24_RecFind(ULS24_Recording* rec, uint64_t t0_ns, uint64_t t1_ns, int channel, uint64_t* out, uint64_t max) {
+    return rec ? rec->reader.Find(t0_ns, t1_ns, channel, out, max) : 0;
+}
+
+int ULS24_TraceStart(const char* path) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    return HidTraceStart(path) ? 1 : 0;
+}
+
+int ULS24_TraceReplay(const char* path, int fast) {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    return HidTraceReplay(path, fast ? HIDTRACE_FAST : HIDTRACE_REALTIME) ? 1 : 0;
+}
+
+void ULS24_TraceStop() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    HidTraceStop();
+}
+
+uint64_t ULS24_TraceMismatches() {
+    std::lock_guard<std::recursive_mutex> lock(g_DeviceLock);
+
+    return HidTraceMismatches();
+}
+
 } // extern "C"
\ No newline at end of file
@@ -0,0 +1,331 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// ULS24 C interface, exported from ULSLIB.so for use in other languages
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ULS24_Initialize();
+void ULS24_Cleanup();
+int ULS24_SelectChannel(int channel);
+int ULS24_SetIntegrationTime(int time_ms);
+int ULS24_SetGainMode(int gain);
+int ULS24_CaptureFrame(int channel);
+int ULS24_GetFrameData(int* frame_data, int* frame_size);     // frame_data must hold 24*24 ints
+int ULS24_Reset();
+
+// Compiled calibration files (format in CalibFile.h). Save writes the
+// calibration read from the device's EEPROM; Load replaces it, skipping the
+// EEPROM readout on later starts. The file must come from the same device.
+// Both return 1 on success.
+//
+// Calibration (trim and dark references) is versioned. Load, DarkClear and
+// DarkLoad publish a new version without waiting for a capture in progress;
+// frames started afterwards use it, and each frame's meta.calib tells which
+// version corrected it. Changed register values are written before the
+// channel's next frame. They wait for a concurrent ULS24_Initialize or
+// ULS24_Cleanup to finish.
+int ULS24_SaveCalibration(const char* path);
+int ULS24_LoadCalibration(const char* path);
+uint32_t ULS24_CalibVersion();          // Latest published version, 0 before any
+
+// Resolution and binning modes
+
+int ULS24_CaptureFrame24(int channel);
+int ULS24_SetTXBin(int pattern);        // 0x0-0xf
+int ULS24_GetFrameSize();               // 12 or 24, dimension of the last captured frame
+
+// LED on minus LED off 12x12 capture on one channel. diff (144 ints, may be
+// NULL) receives the signed difference, which also becomes the current frame.
+int ULS24_CaptureDifferential(int channel, int* diff);
+
+typedef struct {
+    int size;                   // 12 or 24
+    int txbin;
+    int frames;                 // Frames actually captured
+    double frames_per_s;
+    double reports_per_frame;   // HID input reports per frame
+    double mean_latency_ms;     // Capture command to last row
+    double min_latency_ms;
+    double max_latency_ms;
+    double overhead_ms;         // Mean latency beyond the integration time
+} ULS24_ModeProfile;
+
+// Captures frames back to back in the given mode on the current channel and
+// measures throughput. txbin < 0 keeps the current pattern; otherwise the
+// previous pattern is restored afterwards.
+int ULS24_ProfileMode(int size, int txbin, int frames, ULS24_ModeProfile* profile);
+
+// Timed acquisition
+
+typedef struct {
+    int channel;            // 1-4
+    int gain;               // 0=high, 1=low
+    float int_time_ms;      // 1-66000
+    double t_ms;            // Integration start, relative to the schedule epoch
+} ULS24_SchedJob;
+
+typedef struct {
+    double start_ms;        // Actual command time, relative to the schedule epoch
+    double jitter_us;       // Actual minus requested start, positive is late
+    int overrun;            // 1: job could not be started on time
+    int error;              // 1: capture failed
+} ULS24_SchedResult;
+
+typedef struct {
+    int jobs;
+    int overruns;
+    int errors;
+    double mean_jitter_us;
+    double rms_jitter_us;
+    double max_abs_jitter_us;
+    double setup_lead_us;   // How early register programming started before each job
+} ULS24_SchedStats;
+
+// Current CLOCK_MONOTONIC time in ns (same clock as Python's time.monotonic_ns())
+uint64_t ULS24_MonotonicNs();
+
+// Runs a sorted timeline of 12x12 captures on the calling thread. epoch_ns is the
+// CLOCK_MONOTONIC time that t_ms is measured from, 0 for "as soon as possible".
+// frames (n * 144 ints), results (n) and stats may be NULL; a failed job's frame
+// is zeroed. Returns 1 if every job ran, 0 on argument or device error.
+int ULS24_RunSchedule(const ULS24_SchedJob* jobs, int n, uint64_t epoch_ns,
+                      int* frames, ULS24_SchedResult* results, ULS24_SchedStats* stats);
+
+// Frame history. Every successful capture, including those written into caller
+// buffers, is kept in a bounded ring with its metadata; melt runs are not. Peek gives a pointer into the ring without copying; the data stays
+// valid until the slot is recycled, which HistoryValid reports after the fact.
+
+typedef struct {
+    uint64_t seq;           // Capture sequence number
+    uint64_t t_start_ns;    // Capture command sent, CLOCK_MONOTONIC
+    uint64_t t_end_ns;      // Last row received
+    int channel;
+    int gain;
+    float int_time_ms;
+    int size;               // 12 or 24, data is size x size row-major
+    int flags;              // ULS24_FRAME_DIFF: differential frame, signed
+    uint32_t calib;         // Calibration version used to correct it, see ULS24_CalibVersion
+} ULS24_FrameMeta;
+
+#define ULS24_FRAME_DIFF 0x1
+
+int ULS24_HistorySetCapacity(int frames);      // frames >= 2, drops the history
+int ULS24_HistoryRange(uint64_t* first, uint64_t* last);
+int ULS24_HistoryFindTime(uint64_t t0_ns, uint64_t t1_ns, uint64_t* first, uint64_t* last);
+int ULS24_HistoryPeek(uint64_t seq, ULS24_FrameMeta* meta, const int** data);
+int ULS24_HistoryValid(uint64_t seq);
+int ULS24_HistoryCopy(uint64_t seq, ULS24_FrameMeta* meta, int* data);
+
+// Shared-memory publishing. Every frame that enters the history is also
+// written to the POSIX shared-memory ring name (default "/uls24_frames", see
+// ShmReader.h), which other processes read with the uls24shm reader library.
+// Stops on ULS24_Cleanup or when the device is reinitialized.
+
+int ULS24_PublishStart(const char* name, int slots);      // name may be NULL, slots 0: default. 0 if another process publishes under name
+int ULS24_PublishStop();
+
+// Recording. Every frame that enters the history is also appended to segment
+// files prefix.00000.ulsr, prefix.00001.ulsr, ... (format in Recorder.h), each
+// closed with an index after frames_per_segment frames. Recordings are read
+// back through memory maps; record pointers stay valid until ULS24_RecClose.
+
+int ULS24_RecordStart(const char* prefix, int frames_per_segment);     // 0: default (4096)
+int ULS24_RecordStop();                                                 // Writes the last index, 1: success
+
+typedef struct ULS24_Recording ULS24_Recording;
+
+ULS24_Recording* ULS24_RecOpen(const char* prefix);                   // NULL if no segment found
+void ULS24_RecClose(ULS24_Recording* rec);
+uint64_t ULS24_RecCount(ULS24_Recording* rec);
+int ULS24_RecGet(ULS24_Recording* rec, uint64_t n, ULS24_FrameMeta* meta, const int** data);    // data: size x size ints
+// Record numbers with t_start in [t0_ns, t1_ns) on channel (0: any), by time. Returns the total matched.
+uint64_t ULS24_RecFind(ULS24_Recording* rec, uint64_t t0_ns, uint64_t t1_ns, int channel, uint64_t* out, uint64_t max);
+
+// HID traces (format in HidTrace.h). TraceStart records every report exchanged
+// with the device. TraceReplay makes a trace stand in for the device; call it
+// before ULS24_Initialize, which then reads the recorded trim data and serves
+// captures from the recorded row reports, either with the recorded timing or
+// as fast as possible. Replay ends with TraceStop or when the trace runs out,
+// which looks like a device timeout.
+
+int ULS24_TraceStart(const char* path);
+int ULS24_TraceReplay(const char* path, int fast);                     // fast: 0 recorded timing, 1 no waits
+void ULS24_TraceStop();
+uint64_t ULS24_TraceMismatches();       // Output reports that differed from the trace during replay
+
+// Melt-curve acquisition. Configure pins gain and integration time on one or
+// more channels; Run captures 12x12 frames round-robin over them with the
+// capture commands kept back to back, writing into the caller's buffers only:
+// they do not enter the history, the shared-memory ring or a recording.
+
+typedef struct {
+    uint64_t seq;           // Index in the series
+    uint64_t t_ns;          // Capture command sent, CLOCK_MONOTONIC
+    uint64_t t_end_ns;      // Last row received
+    double temp;            // From the temperature callback, NaN if none
+    int channel;
+} ULS24_MeltSample;
+
+typedef double (*ULS24_TempCallback)(void* user);
+
+int ULS24_MeltConfigure(const int* channels, int nchan, int gain, float int_time_ms);
+// series holds frames * 144 ints. Returns the number of frames captured.
+int ULS24_MeltRun(int frames, int* series, ULS24_MeltSample* samples, ULS24_TempCallback temp_cb, void* user);
+void ULS24_MeltStop();      // May be called from another thread or from temp_cb
+
+// Dark frame library. References are keyed by (channel, gain, frame size,
+// integration time) and interpolated for other integration times. When
+// enabled, the matching reference is subtracted during row correction.
+
+int ULS24_DarkCapture(int channel, int gain, float int_time_ms, int navg, int size);   // LEDs off while it runs, settings restored after
+int ULS24_DarkEnable(int enable);
+int ULS24_DarkCount();
+int ULS24_DarkClear();
+int ULS24_DarkSave(const char* path);
+int ULS24_DarkLoad(const char* path);      // Merges into the library
+
+// Automatic calibration of one channel (AutoCal.h). Runs dark and LED ramp
+// sweeps at both gains with frames captures per step (0: default plan), fits
+// the channel's kb and FPN and publishes them like ULS24_LoadCalibration.
+// rms (12 doubles, may be NULL) receives each column's fit residual in LSB.
+// Takes a few minutes; gain and integration time are restored, LEDs left off.
+// Returns 1 if every column was fitted, 0 otherwise (nothing published).
+int ULS24_AutoCalibrate(int channel, int frames, double* rms);
+
+// Online FPN refresh. After every period-th lit 12x12 frame (ULS24_CaptureFrame,
+// capture-into and sequence captures) one dark frame is captured with the
+// same settings and each column's FPN moves towards it by alpha (0-1). New
+// values are published like ULS24_LoadCalibration. period 0: off.
+int ULS24_FpnRefresh(int period, double alpha);
+int ULS24_FpnRefreshCount();            // Dark frames folded in since the last ULS24_FpnRefresh
+
+// Caller-registered output buffers. Register count frame buffers once (e.g. one
+// contiguous NumPy array); each capture then writes corrected pixels directly
+// into the next buffer, row-major, and returns its index. No copy is made and
+// frame_data / the frame history are not updated.
+
+#define ULS24_BUF_INT32  0
+#define ULS24_BUF_UINT16 1
+
+// Single capture straight into dst (size*size ints), meta may be NULL
+int ULS24_CaptureFrameInto(int channel, int size, int* dst, ULS24_FrameMeta* meta);
+
+int ULS24_RegisterBuffers(void* base, int count, int type, int size, size_t stride_bytes);   // stride 0: contiguous
+int ULS24_UnregisterBuffers();
+int ULS24_CaptureToBuffer(int channel, int index);     // index -1: next in turn. Returns index, -1 on error
+int ULS24_GetBufferMeta(int index, ULS24_FrameMeta* meta);
+
+// Asynchronous operations. Requests run in order on a worker thread owned by
+// the library and return an id at once. Completion is reported through the
+// callback (called on the worker thread) and through an eventfd that can be
+// registered with epoll/select/asyncio; ULS24_AsyncPoll then lists the
+// finished ids. A finished request is kept until ULS24_AsyncResult or
+// ULS24_AsyncRelease. Synchronous calls remain usable and are serialized
+// with the worker. A callback must not call ULS24_Initialize or ULS24_Cleanup,
+// which stop the worker it runs on: from a callback they fail (Initialize
+// returns 0) without doing anything. The async calls may race with
+// Initialize and Cleanup on other threads: requests still queued when the
+// worker stops are dropped, and calls made while no worker runs fail.
+
+#define ULS24_ASYNC_PENDING  0
+#define ULS24_ASYNC_DONE     1
+#define ULS24_ASYNC_FAILED   -1
+#define ULS24_ASYNC_UNKNOWN  -2
+
+typedef void (*ULS24_CompletionCallback)(int request_id, int status, void* user);
+
+int ULS24_CaptureAsync(int channel, int size, ULS24_CompletionCallback cb, void* user);   // Returns id > 0, 0 on error
+int ULS24_CaptureDifferentialAsync(int channel, ULS24_CompletionCallback cb, void* user);
+int ULS24_SelectChannelAsync(int channel, ULS24_CompletionCallback cb, void* user);
+int ULS24_SetGainModeAsync(int gain, ULS24_CompletionCallback cb, void* user);
+int ULS24_SetIntegrationTimeAsync(float time_ms, ULS24_CompletionCallback cb, void* user);
+
+// Channels are programmed from their calibration on first use. This queues that
+// work for the channels in channel_mask (bit 0: channel 1) so it happens in the
+// background instead, lowest channel first. The callback runs once per queued
+// channel. Returns the number of requests queued: if it is less than the number
+// of channels in the mask, the lowest that many were queued and the rest were
+// not (0 if none were, or the mask holds no channel).
+int ULS24_PrepareChannelsAsync(int channel_mask, ULS24_CompletionCallback cb, void* user);
+
+int ULS24_AsyncEventFd();                  // -1 if not available on this platform
+int ULS24_AsyncPoll(int* ids, int max);    // Returns the number of ids stored; the eventfd stays readable while more are left
+int ULS24_AsyncStatus(int id);             // ULS24_ASYNC_xxx
+int ULS24_AsyncResult(int id, ULS24_FrameMeta* meta, int* frame);     // frame: size*size ints, may be NULL
+int ULS24_AsyncRelease(int id);
+
+// Batched capture. Executes a list of steps in one call: registers are only
+// written when a step changes them, and every frame is corrected directly into
+// out, a contiguous [total_frames][12][12] int tensor in step order, where
+// total_frames is the sum of repeats.
+
+typedef struct {
+    int channel;            // 1-4
+    int gain;               // 0=high, 1=low
+    float int_time_ms;      // 1-66000
+    int repeats;            // >= 1
+} ULS24_Step;
+
+// meta (total_frames entries) may be NULL. Returns frames captured, -1 on bad arguments.
+int ULS24_CaptureSequence(const ULS24_Step* steps, int n, int* out, ULS24_FrameMeta* meta);
+
+// Standalone correction of raw row reports, for transports other than the
+// library's own (e.g. pyusb). A calibration handle is built from EEPROM pages
+// or a trim file and holds everything the correction needs: these functions do
+// no device I/O, touch no library state and may run concurrently on one handle.
+//
+// A report is the 64-byte input report without the HID report ID, i.e. the
+// preamble 0xaa is byte 0, the command byte 2, the type byte 4 and the row
+// number byte 5.
+
+#define ULS24_REPORT_SIZE 64
+#define ULS24_EEPROM_PAGE 53      // 52 data bytes + parity, bytes 8-60 of an EEPROM read report
+
+typedef struct ULS24_Calib ULS24_Calib;
+
+ULS24_Calib* ULS24_CalibFromEeprom(const uint8_t* pages, int npages);  // pages in index order, NULL if incomplete
+ULS24_Calib* ULS24_CalibFromTrimFile(const char* path);
+ULS24_Calib* ULS24_CalibFromFile(const char* path);                    // Compiled calibration (.ulscal)
+int ULS24_CalibSave(const ULS24_Calib* cal, const char* path);          // 1: success
+void ULS24_CalibFree(ULS24_Calib* cal);
+int ULS24_CalibNumChannels(const ULS24_Calib* cal);
+
+// Corrects one row report into frame[row * stride + col]; flags (may be NULL)
+// gets each pixel's over/underflow code (0 = ok) at the same offsets. frame
+// must hold as many rows as the report has columns. channel 0 takes it from
+// the report type, which only 12x12 reports carry. Returns the number of
+// columns written, 0 if the report is not a valid row or does not fit stride.
+int ULS24_CorrectRow(const ULS24_Calib* cal, int channel, int gain, const uint8_t* report,
+                     int* frame, int stride, uint8_t* flags);
+
+typedef struct {
+    int size;               // 12 or 24
+    int channel;
+    uint32_t row_mask;      // bit r set if row r was received
+    int flagged;            // pixels with a nonzero flag
+} ULS24_CorrectInfo;
+
+// Assembles and corrects frames from a batch of reports. Non-capture reports
+// are skipped. Frame k is written row-major at frames + k * slot (and flags +
+// k * slot), slot >= size * size; missing rows are left 0. A frame ends on its
+// last row, the 0xf1 end code, a change of size or channel, or a row number
+// that is not greater than the previous one. Returns the number of frames
+// completed; *consumed (may be NULL) is the number of reports used, which stops
+// short of an unfinished trailing frame so the caller can resubmit it with the
+// next batch.
+int ULS24_CorrectReports(const ULS24_Calib* cal, int channel, int gain,
+                         const uint8_t* reports, int nreports,
+                         int* frames, uint8_t* flags, int slot, int max_frames,
+                         ULS24_CorrectInfo* info, int* consumed);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,111 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include "MeltAcq.h"
+#include "HidMgr.h"
+#include "MonoClock.h"
+
+#include <math.h>
+
+extern BYTE RxData[];
+
+extern bool	MyDeviceDetected;
+extern BOOL Continue_Flag;
+
+CMeltAcq::CMeltAcq(CInterfaceObject *pObj)
+{
+	m_pObj = pObj;
+
+	m_NumChan = 0;
+	m_Configured = false;
+
+	m_TempSource = NULL;
+	m_TempUser = NULL;
+
+	m_Stop = 0;
+}
+
+// Gain and integration time are per channel, so each channel is programmed
+// here once and Run only sends capture commands.
+
+int CMeltAcq::Configure(const int *chans, int nchan, int gain, float int_time)
+{
+	if (nchan < 1 || nchan > MELT_MAX_CHAN)
+		return 0;
+
+	for (int i = 0; i < nchan; i++) {
+		if (chans[i] < 1 || chans[i] > 4)
+			return 0;
+	}
+
+	for (int i = 0; i < nchan; i++) {
+		m_Chan[i] = chans[i];
+
+		m_pObj->SelSensor((BYTE)chans[i]);
+		m_pObj->SetGainMode(gain);
+		m_pObj->SetIntTime(int_time);
+	}
+
+	m_NumChan = nchan;
+	m_Configured = true;
+
+	return 1;
+}
+
+// The temperature is read after the command is sent, while the device
+// integrates, so a slow source does not delay the frame
+
+void CMeltAcq::Issue(int k, MeltSample *sample)
+{
+	sample->seq = k;
+	sample->chan = m_Chan[k % m_NumChan];
+
+	m_pObj->IssueCapture12((BYTE)sample->chan);
+	sample->t_issue = MonoTimeNs();
+
+	sample->temp = m_TempSource ? m_TempSource(m_TempUser) : NAN;
+}
+
+int CMeltAcq::Run(int nframes, int *series, MeltSample *samples)
+{
+	if (!m_Configured || nframes < 1 || !series || !samples)
+		return 0;
+
+	m_Stop = 0;
+
+	int k = 0;
+	Issue(0, &samples[0]);
+
+	bool pending = true;			// A command has been sent whose rows are still to come
+
+	while (pending) {
+		int *frame = series + k * MELT_FRAME_PIXELS;
+
+		pending = false;
+		Continue_Flag = true;
+
+		while (Continue_Flag) {
+			ReadHIDInputReport();
+			if (!MyDeviceDetected)
+				return k;
+
+			m_pObj->ProcessRowData(frame, 12);
+
+			// Keep the device busy: the next command goes out as soon as the last row
+			// is corrected. Not before, issuing may switch the calibration set and
+			// program the channel, which overwrites RxData.
+
+			if (!Continue_Flag && k + 1 < nframes && !m_Stop) {
+				Issue(k + 1, &samples[k + 1]);
+				pending = true;
+			}
+		}
+
+		samples[k].t_end = MonoTimeNs();
+		k++;
+	}
+
+	return k;
+}
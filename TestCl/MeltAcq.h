@@ -0,0 +1,60 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+
+#include "InterfaceObj.h"
+
+#define MELT_MAX_CHAN 4
+#define MELT_FRAME_PIXELS (12 * 12)
+
+struct MeltSample {
+	uint64_t	seq;				// Index in the series
+	uint64_t	t_issue;			// Capture command sent, MonoTimeNs() clock
+	uint64_t	t_end;				// Last row received
+	double		temp;				// External temperature read just after t_issue, NAN if no source
+	int			chan;
+};
+
+typedef double (*MeltTempSource)(void *user);		// Return NAN when no reading is available
+
+// High-rate 12x12 acquisition for melt ramps. Channel registers are programmed
+// once by Configure; Run then streams captures round-robin over the channels,
+// sending the next capture command as soon as the last row of the current frame
+// has arrived and been corrected, so each frame uses one calibration version.
+// Frames go straight into the caller's series buffer, bypassing frame_data and
+// the frame history.
+
+class CMeltAcq {
+
+protected:
+
+	CInterfaceObject *m_pObj;
+
+	int			m_Chan[MELT_MAX_CHAN];
+	int			m_NumChan;
+	bool		m_Configured;
+
+	MeltTempSource m_TempSource;
+	void		*m_TempUser;
+
+	volatile int m_Stop;
+
+public:
+
+	CMeltAcq(CInterfaceObject *pObj);
+
+	int  Configure(const int *chans, int nchan, int gain, float int_time);
+	void SetTempSource(MeltTempSource src, void *user) { m_TempSource = src; m_TempUser = user; }
+	void Stop() { m_Stop = 1; }
+
+	// Captures up to nframes into series (nframes * 144 ints) and samples (nframes).
+	// Returns the number of frames captured; fewer on Stop() or device error.
+	int  Run(int nframes, int *series, MeltSample *samples);
+
+protected:
+
+	void Issue(int k, MeltSample *sample);
+};
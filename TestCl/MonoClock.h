@@ -0,0 +1,46 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <chrono>
+#include <thread>
+#else
+#include <time.h>
+#include <errno.h>
+#endif
+
+// Monotonic time base shared by the acquisition code. On Linux this is
+// CLOCK_MONOTONIC, so values can be compared with timerfd/clock_nanosleep deadlines.
+
+inline uint64_t MonoTimeNs()
+{
+#ifdef _WIN32
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Sleep until an absolute monotonic deadline. Returns immediately if the deadline has passed.
+
+inline void SleepUntilNs(uint64_t deadline)
+{
+#ifdef _WIN32
+	uint64_t now = MonoTimeNs();
+	if (deadline > now)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+#else
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / 1000000000ull);
+	ts.tv_nsec = (long)(deadline % 1000000000ull);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#endif
+}
@@ -0,0 +1,215 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// Transport-independent row correction. Each handle owns its own CTrimReader,
+// so only Node calibration data is read during correction and nothing is
+// shared with the device path in InterfaceWrapper.cpp.
+
+#include "stdafx.h"
+
+#include <string.h>
+#include <new>
+
+#include "HidMgr.h"
+#include "TrimReader.h"
+#include "InterfaceWrapper.h"
+
+#define EndOfFrame  0xf1
+
+struct ULS24_Calib {
+	CTrimReader reader;
+};
+
+// Saving only reads the calibration, SaveCalib is just not declared const.
+
+static CTrimReader *Reader(const ULS24_Calib *cal)
+{
+	return const_cast<CTrimReader *>(&cal->reader);
+}
+
+// Row reports: 12x12 types x2 (channel in the high nibble) and 24x24 type 0x08
+
+static int IsRowReport(const uint8_t *rx)
+{
+	return rx[2] == GetCmd && ((rx[4] & 0x0f) == 0x02 || rx[4] == 0x08);
+}
+
+static int ReportChannel(const uint8_t *rx, int channel)
+{
+	if (channel)
+		return channel;
+
+	return (rx[4] & 0x0f) == 0x02 ? (rx[4] >> 4) + 1 : 0;
+}
+
+static void FillInfo(ULS24_CorrectInfo *info, int size, int chan, uint32_t mask, const uint8_t *flags)
+{
+	info->size = size;
+	info->channel = chan;
+	info->row_mask = mask;
+	info->flagged = 0;
+
+	if (flags) {
+		for (int k = 0; k < size * size; k++)
+			if (flags[k]) info->flagged++;
+	}
+}
+
+extern "C" {
+
+ULS24_Calib* ULS24_CalibFromEeprom(const uint8_t* pages, int npages) {
+    if (!pages || npages < 1) return NULL;
+
+    ULS24_Calib* cal = new (std::nothrow) ULS24_Calib;
+    if (!cal) return NULL;
+
+    if (!cal->reader.ReadTrimData((const BYTE (*)[EPKT_SZ + 1])pages, npages)) {
+        delete cal;
+        return NULL;
+    }
+
+    cal->reader.RestoreNodes();     // Decoded up front, correction must not modify the handle
+
+    return cal;
+}
+
+ULS24_Calib* ULS24_CalibFromTrimFile(const char* path) {
+    if (!path) return NULL;
+
+    ULS24_Calib* cal = new (std::nothrow) ULS24_Calib;
+    if (!cal) return NULL;
+
+    if (!cal->reader.Load((TCHAR*)path)) {
+        delete cal;
+        return NULL;
+    }
+
+    cal->reader.Parse();
+
+    for (int i = 0; i < cal->reader.NumNode; i++)
+        cal->reader.Convert2Int(i);        // Correction uses the integer kb/fpn
+
+    if (!cal->reader.NumNode) {
+        delete cal;
+        return NULL;
+    }
+
+    return cal;
+}
+
+ULS24_Calib* ULS24_CalibFromFile(const char* path) {
+    if (!path) return NULL;
+
+    ULS24_Calib* cal = new (std::nothrow) ULS24_Calib;
+    if (!cal) return NULL;
+
+    if (!cal->reader.LoadCalib(path)) {
+        delete cal;
+        return NULL;
+    }
+
+    return cal;
+}
+
+int ULS24_CalibSave(const ULS24_Calib* cal, const char* path) {
+    if (!cal || !path) return 0;
+
+    return Reader(cal)->SaveCalib(path);
+}
+
+void ULS24_CalibFree(ULS24_Calib* cal) {
+    delete cal;
+}
+
+int ULS24_CalibNumChannels(const ULS24_Calib* cal) {
+    return cal ? cal->reader.NumNode : 0;
+}
+
+int ULS24_CorrectRow(const ULS24_Calib* cal, int channel, int gain, const uint8_t* report,
+                     int* frame, int stride, uint8_t* flags) {
+    if (!cal || !report || !frame || !IsRowReport(report)) return 0;
+
+    int chan = ReportChannel(report, channel);
+    if (chan < 1 || chan > cal->reader.NumNode) return 0;
+
+    return cal->reader.CorrectRowT<int>(report, chan, gain, frame, CTrimReader::ReportCols(report), stride, NULL, flags);
+}
+
+int ULS24_CorrectReports(const ULS24_Calib* cal, int channel, int gain,
+                         const uint8_t* reports, int nreports,
+                         int* frames, uint8_t* flags, int slot, int max_frames,
+                         ULS24_CorrectInfo* info, int* consumed) {
+    if (consumed) *consumed = 0;
+    if (!cal || !reports || !frames || nreports < 0 || max_frames < 1) return 0;
+
+    int nf = 0;
+    int start = 0;              // first report of the frame being assembled
+    int size = 0;               // 0: no frame open
+    int chan = 0;
+    int last = -1;              // last row of the open frame
+    uint32_t mask = 0;
+
+    int i;
+
+    for (i = 0; i < nreports; i++) {
+        const uint8_t* rx = reports + (size_t)i * ULS24_REPORT_SIZE;
+
+        if (!IsRowReport(rx)) {
+            if (!size) start = i + 1;
+            continue;
+        }
+
+        int ncol = CTrimReader::ReportCols(rx);
+        int end = rx[5] == EndOfFrame;
+
+        // A row that does not follow the last one, or from another channel,
+        // starts the next capture: the open frame lost its last row
+        int next = !end && rx[5] < ncol && (rx[5] <= last || ReportChannel(rx, channel) != chan);
+
+        if (size && (ncol != size || end || next)) {    // close the open frame
+            if (info) FillInfo(&info[nf], size, chan, mask, flags ? flags + (size_t)nf * slot : NULL);
+            nf++;
+            size = 0;
+            start = end ? i + 1 : i;
+            if (end) continue;
+        }
+
+        if (end) {
+            start = i + 1;
+            continue;
+        }
+
+        if (!size) {
+            if (nf == max_frames || ncol * ncol > slot) break;
+
+            size = ncol;
+            chan = ReportChannel(rx, channel);
+            last = -1;
+            mask = 0;
+            memset(frames + (size_t)nf * slot, 0, size * size * sizeof(int));
+            if (flags) memset(flags + (size_t)nf * slot, 0, size * size);
+        }
+
+        int* dst = frames + (size_t)nf * slot;
+        uint8_t* fdst = flags ? flags + (size_t)nf * slot : NULL;
+
+        if (chan >= 1 && chan <= cal->reader.NumNode &&
+            cal->reader.CorrectRowT<int>(rx, chan, gain, dst, size, size, NULL, fdst))
+            mask |= 1u << rx[5];
+
+        if (rx[5] < size) last = rx[5];
+
+        if (rx[5] == size - 1) {                    // last row, frame complete
+            if (info) FillInfo(&info[nf], size, chan, mask, fdst);
+            nf++;
+            size = 0;
+            start = i + 1;
+        }
+    }
+
+    if (consumed) *consumed = size ? start : i;
+
+    return nf;
+}
+
+}
@@ -0,0 +1,402 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "Recorder.h"
+#include "MonoClock.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static std::string SegmentPath(const std::string &prefix, int segment)
+{
+	char name[16];
+	snprintf(name, sizeof(name), ".%05d.ulsr", segment);
+
+	return prefix + name;
+}
+
+static bool IndexLess(const RecIndexEntry &a, const RecIndexEntry &b)
+{
+	if (a.t_start != b.t_start) return a.t_start < b.t_start;
+	if (a.chan != b.chan) return a.chan < b.chan;
+	return a.seq < b.seq;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CFrameRecorder
+/////////////////////////////////////////////////////////////////////////////
+
+CFrameRecorder::CFrameRecorder()
+{
+	m_Open = false;
+	m_FramesPerSegment = REC_DEFAULT_FRAMES;
+	m_Segment = 0;
+	m_Recording = 0;
+	m_File = NULL;
+	m_Count = 0;
+	m_Buf = NULL;
+	m_BufCount = 0;
+}
+
+CFrameRecorder::~CFrameRecorder()
+{
+	Close();
+}
+
+int CFrameRecorder::Open(const char *prefix, int frames_per_segment)
+{
+	Close();
+
+	if (!prefix || frames_per_segment < 1)
+		return 0;
+
+	m_Prefix = prefix;
+	m_FramesPerSegment = frames_per_segment;
+	m_Segment = 0;
+
+	if (!m_Buf)
+		m_Buf = new FrameRecord[REC_BUFFER_FRAMES];
+
+	m_Open = OpenSegment() != 0;
+
+	return m_Open;
+}
+
+int CFrameRecorder::Close()
+{
+	int ok = m_File ? CloseSegment() : m_Open;
+
+	m_Open = false;
+
+	delete [] m_Buf;
+	m_Buf = NULL;
+
+	return ok;
+}
+
+int CFrameRecorder::OpenSegment()
+{
+	m_File = fopen(SegmentPath(m_Prefix, m_Segment).c_str(), "wb");
+	if (!m_File)
+		return 0;
+
+	setvbuf(m_File, NULL, _IONBF, 0);			// Writes are already batched
+
+	RecSegmentHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = REC_MAGIC;
+	h.version = REC_VERSION;
+	h.record_bytes = sizeof(FrameRecord);
+	h.segment = m_Segment;
+	h.t_created = MonoTimeNs();
+
+	if (!m_Segment)
+		m_Recording = h.t_created;
+	h.recording = m_Recording;
+
+	m_Count = 0;
+	m_BufCount = 0;
+	m_Index.clear();
+	m_Index.reserve(m_FramesPerSegment);
+
+	if (fwrite(&h, sizeof(h), 1, m_File) != 1) {
+		fclose(m_File);
+		m_File = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+int CFrameRecorder::CloseSegment()
+{
+	if (!m_File)
+		return 0;
+
+	int ok = Flush();
+
+	std::sort(m_Index.begin(), m_Index.end(), IndexLess);
+
+	RecFooter f;
+	f.magic = REC_INDEX_MAGIC;
+	f.count = m_Count;
+	f.index_offset = sizeof(RecSegmentHeader) + (uint64_t)m_Count * sizeof(FrameRecord);
+
+	if (ok && !m_Index.empty() && fwrite(&m_Index[0], sizeof(RecIndexEntry), m_Index.size(), m_File) != m_Index.size())
+		ok = 0;
+	if (ok && fwrite(&f, sizeof(f), 1, m_File) != 1)
+		ok = 0;
+
+	if (fclose(m_File) != 0)
+		ok = 0;
+
+	m_File = NULL;
+	m_Segment++;
+
+	return ok;
+}
+
+int CFrameRecorder::Flush()
+{
+	if (!m_File || !m_BufCount)
+		return m_File != NULL;
+
+	size_t want = m_BufCount;
+	m_BufCount = 0;
+
+	return fwrite(m_Buf, sizeof(FrameRecord), want, m_File) == want;
+}
+
+int CFrameRecorder::Write(const FrameMeta &meta, const int *frame, int stride)
+{
+	if (!m_Open || (!m_File && !OpenSegment()))
+		return 0;
+
+	FrameRecord *r = &m_Buf[m_BufCount];
+	int n = meta.size == 24 ? 24 : 12;
+
+	r->seq = meta.seq;
+	r->t_start = meta.t_start;
+	r->t_end = meta.t_end;
+	r->chan = meta.chan;
+	r->gain = meta.gain;
+	r->int_time = meta.int_time;
+	r->size = n;
+	r->flags = meta.flags;
+	r->calib = meta.calib;
+	r->reserved = 0;
+	r->marker = REC_RECORD_MAGIC;
+
+	for (int i = 0; i < n; i++)
+		memcpy(&r->data[i * n], frame + i * stride, n * sizeof(int));
+	if (n < 24)
+		memset(&r->data[n * n], 0, (RING_FRAME_PIXELS - n * n) * sizeof(int));		// Deterministic file contents
+
+	RecIndexEntry e;
+	e.t_start = meta.t_start;
+	e.seq = meta.seq;
+	e.chan = meta.chan;
+	e.record = m_Count;
+	m_Index.push_back(e);
+
+	m_Count++;
+
+	if (++m_BufCount == REC_BUFFER_FRAMES && !Flush())
+		return 0;
+
+	if (m_Count == (uint32_t)m_FramesPerSegment)
+		return CloseSegment();
+
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CRecordingReader
+/////////////////////////////////////////////////////////////////////////////
+
+CRecordingReader::CRecordingReader()
+{
+	m_Count = 0;
+}
+
+CRecordingReader::~CRecordingReader()
+{
+	Close();
+}
+
+void CRecordingReader::Close()
+{
+#ifndef _WIN32
+	for (size_t i = 0; i < m_Segments.size(); i++) {
+		munmap(m_Segments[i]->base, m_Segments[i]->size);
+		delete m_Segments[i];
+	}
+#endif
+
+	m_Segments.clear();
+	m_Count = 0;
+}
+
+int CRecordingReader::Open(const char *prefix)
+{
+	Close();
+
+	if (!prefix)
+		return 0;
+
+	uint64_t recording = 0;
+
+	for (int i = 0; ; i++) {
+		if (!MapSegment(SegmentPath(prefix, i).c_str(), &recording))
+			break;
+	}
+
+	return (int)m_Segments.size();
+}
+
+int CRecordingReader::MapSegment(const char *path, uint64_t *recording)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(RecSegmentHeader)) {
+		close(fd);
+		return 0;
+	}
+
+	size_t size = st.st_size;
+	void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return 0;
+
+	const RecSegmentHeader *h = (const RecSegmentHeader *)base;
+
+	bool v1 = h->version == 1 && h->record_bytes == sizeof(FrameRecordV1);
+
+	if (h->magic != REC_MAGIC || (!v1 && (h->version != REC_VERSION || h->record_bytes != sizeof(FrameRecord))) ||
+		(m_Segments.size() && h->recording != *recording)) {
+		munmap(base, size);
+		return 0;
+	}
+
+	*recording = h->recording;
+
+	Segment *s = new Segment;
+	s->base = base;
+	s->size = size;
+	s->records = (const FrameRecord *)(h + 1);
+	s->first = m_Count;
+	s->index = NULL;
+
+	const FrameRecordV1 *old = (const FrameRecordV1 *)(h + 1);
+	size_t rb = h->record_bytes;
+
+	// Trust the footer only if it is consistent with the file size
+
+	const RecFooter *f = (const RecFooter *)((const char *)base + size - sizeof(RecFooter));
+	bool footer = size >= sizeof(RecSegmentHeader) + sizeof(RecFooter) && f->magic == REC_INDEX_MAGIC &&
+		f->index_offset == sizeof(RecSegmentHeader) + (uint64_t)f->count * rb &&
+		f->index_offset + (uint64_t)f->count * sizeof(RecIndexEntry) + sizeof(RecFooter) == size;
+
+	if (footer)
+		s->count = f->count;
+	else {
+		uint32_t max = (uint32_t)((size - sizeof(RecSegmentHeader)) / rb);
+
+		s->count = 0;
+		while (s->count < max && (v1 ? old[s->count].marker : s->records[s->count].marker) == REC_RECORD_MAGIC)
+			s->count++;
+	}
+
+	if (v1) {
+		s->converted.resize(s->count);
+
+		for (uint32_t i = 0; i < s->count; i++) {
+			FrameRecord &r = s->converted[i];
+			r.seq = old[i].seq;
+			r.t_start = old[i].t_start;
+			r.t_end = old[i].t_end;
+			r.chan = old[i].chan;
+			r.gain = old[i].gain;
+			r.int_time = old[i].int_time;
+			r.size = old[i].size;
+			r.flags = old[i].flags;
+			r.calib = 0;				// Not recorded
+			r.reserved = 0;
+			r.marker = old[i].marker;
+			memcpy(r.data, old[i].data, sizeof(r.data));
+		}
+
+		s->records = s->count ? &s->converted[0] : NULL;
+	}
+
+	if (footer)
+		s->index = (const RecIndexEntry *)((const char *)base + f->index_offset);
+	else {
+		s->rebuilt.resize(s->count);
+		for (uint32_t i = 0; i < s->count; i++) {
+			s->rebuilt[i].t_start = s->records[i].t_start;
+			s->rebuilt[i].seq = s->records[i].seq;
+			s->rebuilt[i].chan = s->records[i].chan;
+			s->rebuilt[i].record = i;
+		}
+		std::sort(s->rebuilt.begin(), s->rebuilt.end(), IndexLess);
+
+		s->index = s->count ? &s->rebuilt[0] : NULL;
+	}
+
+	madvise(base, size, MADV_RANDOM);
+
+	m_Segments.push_back(s);
+	m_Count += s->count;
+
+	return 1;
+#endif
+}
+
+const FrameRecord *CRecordingReader::Get(uint64_t n)
+{
+	if (n >= m_Count)
+		return NULL;
+
+	// Last segment whose first record is <= n
+
+	size_t lo = 0, hi = m_Segments.size();
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (m_Segments[mid]->first <= n)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	const Segment *s = m_Segments[lo];
+
+	return &s->records[n - s->first];
+}
+
+uint64_t CRecordingReader::Find(uint64_t t0, uint64_t t1, int chan, uint64_t *out, uint64_t max)
+{
+	uint64_t found = 0;
+
+	for (size_t k = 0; k < m_Segments.size(); k++) {
+		const Segment *s = m_Segments[k];
+
+		if (!s->count || s->index[s->count - 1].t_start < t0 || s->index[0].t_start >= t1)
+			continue;
+
+		RecIndexEntry key;
+		key.t_start = t0;
+		key.chan = INT32_MIN;
+		key.seq = 0;
+		key.record = 0;
+
+		const RecIndexEntry *e = std::lower_bound(s->index, s->index + s->count, key, IndexLess);
+
+		for (; e != s->index + s->count && e->t_start < t1; e++) {
+			if (chan && e->chan != chan)
+				continue;
+			if (found < max && out)
+				out[found] = s->first + e->record;
+			found++;
+		}
+	}
+
+	return found;
+}
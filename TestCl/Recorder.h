@@ -0,0 +1,168 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "FrameRing.h"
+
+// Frame recordings. Every frame that enters the history is recorded, all
+// captures but melt runs. A recording is a series of segment files
+// prefix.00000.ulsr, prefix.00001.ulsr, ... each holding:
+//
+//	RecSegmentHeader
+//	FrameRecord[count]				fixed size, in capture order
+//	RecIndexEntry[count]			sorted by (t_start, chan, seq)
+//	RecFooter						at the very end of the file
+//
+// The index and footer are written when the segment is closed. A segment cut
+// short by a crash has no valid footer; the reader then rebuilds its index from
+// the complete records. Open creates the first segment file, so a bad prefix
+// fails there; each later one is created for its first frame.
+//
+// Records reach the file REC_BUFFER_FRAMES at a time, and when a segment is
+// closed. A crash therefore loses up to REC_BUFFER_FRAMES - 1 frames written
+// since the last batch; Flush writes them out early.
+
+#define REC_MAGIC			0x52534c55		// "ULSR"
+#define REC_INDEX_MAGIC		0x58444e49		// "INDX"
+#define REC_RECORD_MAGIC	0x44524345		// "ECRD", marks complete records for index rebuilds
+#define REC_VERSION			2				// 2: calib in FrameRecord. Version 1 segments are still read
+#define REC_DEFAULT_FRAMES	4096			// Records per segment, about 9.6 MB
+#define REC_BUFFER_FRAMES	64				// Records gathered before each write
+
+struct RecSegmentHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	record_bytes;				// sizeof(FrameRecord)
+	uint32_t	segment;					// Position in the recording
+	uint64_t	t_created;					// MonoTimeNs when the segment was opened
+	uint64_t	recording;					// t_created of segment 0, so leftovers of an older run are not chained on
+	uint64_t	reserved[4];
+};
+
+struct FrameRecord {
+	uint64_t	seq;
+	uint64_t	t_start;
+	uint64_t	t_end;
+	int32_t		chan;
+	int32_t		gain;
+	float		int_time;
+	int32_t		size;						// 12 or 24, data is size x size row-major
+	int32_t		flags;						// FRAME_FLAG_xxx
+	uint32_t	calib;						// Calibration version that corrected it
+	uint32_t	reserved;
+	uint32_t	marker;						// REC_RECORD_MAGIC
+	int32_t		data[RING_FRAME_PIXELS];
+};
+
+struct FrameRecordV1 {						// Version 1 layout, converted to FrameRecord when read
+	uint64_t	seq;
+	uint64_t	t_start;
+	uint64_t	t_end;
+	int32_t		chan;
+	int32_t		gain;
+	float		int_time;
+	int32_t		size;
+	int32_t		flags;
+	uint32_t	marker;
+	int32_t		data[RING_FRAME_PIXELS];
+};
+
+struct RecIndexEntry {
+	uint64_t	t_start;
+	uint64_t	seq;
+	int32_t		chan;
+	uint32_t	record;						// Position in the segment
+};
+
+struct RecFooter {
+	uint32_t	magic;						// REC_INDEX_MAGIC
+	uint32_t	count;
+	uint64_t	index_offset;
+};
+
+// Appends frames to a recording. Records are assembled in a buffer and written
+// REC_BUFFER_FRAMES at a time, so the per-frame cost is a copy into it.
+
+class CFrameRecorder {
+
+protected:
+
+	std::string	m_Prefix;
+	bool		m_Open;
+	int			m_FramesPerSegment;
+	int			m_Segment;
+	uint64_t	m_Recording;
+
+	FILE		*m_File;
+	uint32_t	m_Count;						// Records in the open segment
+	std::vector<RecIndexEntry> m_Index;
+
+	FrameRecord	*m_Buf;
+	int			m_BufCount;
+
+public:
+
+	CFrameRecorder();
+	~CFrameRecorder();
+
+	int  Open(const char *prefix, int frames_per_segment = REC_DEFAULT_FRAMES);	// 1: success
+	int  Close();								// Flushes and writes the index, 1: success
+	bool IsOpen() { return m_Open; }
+
+	int  Write(const FrameMeta &meta, const int *frame, int stride);	// frame: meta.size rows, stride ints apart
+	int  Flush();
+
+protected:
+
+	int  OpenSegment();
+	int  CloseSegment();
+};
+
+// Read access to a recording. Segments are mapped, not read, so opening a
+// long run costs one mmap per segment plus the index of any segment that
+// lacks one. Version 1 segments are copied into the current record layout
+// instead, with calib 0. Records are numbered across segments in file order.
+
+class CRecordingReader {
+
+protected:
+
+	struct Segment {
+		void		*base;
+		size_t		size;
+		const FrameRecord *records;				// In the mapping, or converted from version 1
+		std::vector<FrameRecord> converted;
+		uint32_t	count;
+		const RecIndexEntry *index;				// In the mapping, or rebuilt
+		std::vector<RecIndexEntry> rebuilt;
+		uint64_t	first;						// Number of the first record
+	};
+
+	std::vector<Segment *> m_Segments;
+	uint64_t	m_Count;
+
+public:
+
+	CRecordingReader();
+	~CRecordingReader();
+
+	int  Open(const char *prefix);				// Number of segments mapped, 0 if none
+	void Close();
+
+	uint64_t GetCount() { return m_Count; }
+	const FrameRecord *Get(uint64_t n);			// NULL if out of range
+
+	// Records with t_start in [t0, t1) and chan (0: any), in (t_start, chan, seq)
+	// order. Stores up to max numbers and returns how many matched in total.
+	uint64_t Find(uint64_t t0, uint64_t t1, int chan, uint64_t *out, uint64_t max);
+
+protected:
+
+	int  MapSegment(const char *path, uint64_t *recording);
+};
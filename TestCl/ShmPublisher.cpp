@@ -0,0 +1,173 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "ShmPublisher.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// An existing object under name may be replaced only if it is a ring whose
+// publisher closed it or is gone. A live ring of another process, or anything
+// that is not a ring, is left alone.
+
+static bool Replaceable(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	struct stat st;
+	bool ok = false;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ULS24_ShmHeader)) {
+		void *base = mmap(NULL, sizeof(ULS24_ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+
+		if (base != MAP_FAILED) {
+			const ULS24_ShmHeader *h = (const ULS24_ShmHeader *)base;
+
+			if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == ULS24_SHM_MAGIC) {
+				pid_t pid = (pid_t)h->writer_pid;
+
+				ok = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE) == ULS24_SHM_CLOSED ||
+					(kill(pid, 0) < 0 && errno == ESRCH);
+			}
+
+			munmap(base, sizeof(ULS24_ShmHeader));
+		}
+	}
+
+	close(fd);
+
+	return ok;
+}
+
+#endif
+
+CShmPublisher::CShmPublisher()
+{
+	m_Hdr = NULL;
+	m_Slots = NULL;
+	m_MapSize = 0;
+}
+
+CShmPublisher::~CShmPublisher()
+{
+	Close();
+}
+
+int CShmPublisher::Open(const char *name, int slots)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	Close();
+
+	if (!name)
+		name = ULS24_SHM_DEFAULT;
+	if (slots < 2)
+		return 0;
+
+	// A fresh object each time: readers still mapping an old one see it
+	// closed and reopen, rather than having it resized under them.
+
+	if (!Replaceable(name))
+		return 0;
+
+	shm_unlink(name);
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return 0;
+
+	size_t size = sizeof(ULS24_ShmHeader) + (size_t)slots * sizeof(ULS24_ShmSlot);
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED) {
+		shm_unlink(name);
+		return 0;
+	}
+
+	m_Hdr = (ULS24_ShmHeader *)base;
+	m_Slots = (ULS24_ShmSlot *)(m_Hdr + 1);
+	m_MapSize = size;
+	m_Name = name;
+
+	// ftruncate zero-filled the object, so every stamp is 0 (no frame)
+
+	m_Hdr->version = ULS24_SHM_VERSION;
+	m_Hdr->slots = slots;
+	m_Hdr->slot_bytes = sizeof(ULS24_ShmSlot);
+	m_Hdr->state = ULS24_SHM_LIVE;
+	m_Hdr->writer_pid = (uint32_t)getpid();
+	m_Hdr->next = 0;
+	__atomic_store_n(&m_Hdr->magic, ULS24_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 1;
+#endif
+}
+
+void CShmPublisher::Close()
+{
+#ifndef _WIN32
+	if (!m_Hdr)
+		return;
+
+	__atomic_store_n(&m_Hdr->state, ULS24_SHM_CLOSED, __ATOMIC_RELEASE);
+
+	munmap(m_Hdr, m_MapSize);
+	shm_unlink(m_Name.c_str());
+
+	m_Hdr = NULL;
+	m_Slots = NULL;
+	m_MapSize = 0;
+#endif
+}
+
+void CShmPublisher::Publish(const FrameMeta &meta, const int *frame, int stride)
+{
+	if (!m_Hdr)
+		return;
+
+	uint64_t seq = m_Hdr->next;			// Single writer
+	ULS24_ShmSlot *slot = &m_Slots[seq % m_Hdr->slots];
+	int n = meta.size == 24 ? 24 : 12;
+
+	__atomic_store_n(&slot->stamp, 2 * seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->meta.seq = seq;
+	slot->meta.t_start_ns = meta.t_start;
+	slot->meta.t_end_ns = meta.t_end;
+	slot->meta.channel = meta.chan;
+	slot->meta.gain = meta.gain;
+	slot->meta.int_time_ms = meta.int_time;
+	slot->meta.size = n;
+	slot->meta.flags = meta.flags;
+	slot->meta.calib = meta.calib;
+
+	for (int i = 0; i < n; i++)
+		memcpy(&slot->data[i * n], frame + i * stride, n * sizeof(int));
+
+	__atomic_store_n(&slot->stamp, 2 * seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&m_Hdr->next, seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,36 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <string>
+
+#include "FrameRing.h"
+#include "ShmReader.h"
+
+#define SHM_DEFAULT_SLOTS 64
+
+// Writer side of the shared-memory frame ring (layout in ShmReader.h). Owned by
+// the capturing process; Publish is called from the capture path only, so
+// there is a single writer and it never waits for readers.
+
+class CShmPublisher {
+
+protected:
+
+	ULS24_ShmHeader	*m_Hdr;
+	ULS24_ShmSlot	*m_Slots;
+	size_t			m_MapSize;
+	std::string		m_Name;
+
+public:
+
+	CShmPublisher();
+	~CShmPublisher();
+
+	int  Open(const char *name, int slots = SHM_DEFAULT_SLOTS);		// Replaces a closed or orphaned ring of that name, fails on a live one. 1: success
+	void Close();														// Marks the ring closed for readers and unlinks it
+	bool IsOpen() { return m_Hdr != NULL; }
+
+	void Publish(const FrameMeta &meta, const int *frame, int stride);	// frame: meta.size rows, stride ints apart
+};
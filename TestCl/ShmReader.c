@@ -0,0 +1,145 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShmReader.h"
+
+#define SHM_READ_RETRIES 4
+
+struct ULS24_ShmReader {
+    ULS24_ShmHeader* hdr;
+    ULS24_ShmSlot* slots;
+    size_t map_size;
+    uint64_t cursor;
+};
+
+ULS24_ShmReader* ULS24_ShmOpen(const char* name) {
+    if (!name) name = ULS24_SHM_DEFAULT;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ULS24_ShmHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    ULS24_ShmHeader* hdr = (ULS24_ShmHeader*)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != ULS24_SHM_MAGIC ||
+        hdr->version != ULS24_SHM_VERSION || hdr->slot_bytes != sizeof(ULS24_ShmSlot) || !hdr->slots ||
+        sizeof(ULS24_ShmHeader) + (size_t)hdr->slots * sizeof(ULS24_ShmSlot) > (size_t)st.st_size) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    ULS24_ShmReader* r = (ULS24_ShmReader*)malloc(sizeof(ULS24_ShmReader));
+    if (!r) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    r->hdr = hdr;
+    r->slots = (ULS24_ShmSlot*)(hdr + 1);
+    r->map_size = st.st_size;
+    r->cursor = ULS24_ShmHead(r);
+
+    return r;
+}
+
+void ULS24_ShmClose(ULS24_ShmReader* r) {
+    if (!r) return;
+
+    munmap(r->hdr, r->map_size);
+    free(r);
+}
+
+uint64_t ULS24_ShmHead(const ULS24_ShmReader* r) {
+    return __atomic_load_n(&r->hdr->next, __ATOMIC_ACQUIRE);
+}
+
+int ULS24_ShmState(const ULS24_ShmReader* r) {
+    return (int)__atomic_load_n(&r->hdr->state, __ATOMIC_ACQUIRE);
+}
+
+int ULS24_ShmRead(const ULS24_ShmReader* r, uint64_t seq, ULS24_FrameMeta* meta, int* data) {
+    const ULS24_ShmSlot* slot = &r->slots[seq % r->hdr->slots];
+    uint64_t want = 2 * seq + 2;
+
+    for (int i = 0; i < SHM_READ_RETRIES; i++) {
+        uint64_t s1 = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+
+        if (s1 != want) {
+            if (s1 == want - 1) continue;       // Being written right now
+            return 0;                           // Not published yet or recycled
+        }
+
+        ULS24_FrameMeta m = slot->meta;
+        int n = m.size == 24 ? 24 * 24 : 12 * 12;
+        if (data) memcpy(data, slot->data, n * sizeof(int));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) != s1)
+            return 0;                           // Overwritten during the copy
+
+        if (meta) *meta = m;
+        return 1;
+    }
+
+    return 0;
+}
+
+int ULS24_ShmNext(ULS24_ShmReader* r, ULS24_FrameMeta* meta, int* data, uint64_t* lost) {
+    uint64_t skipped = 0;
+
+    for (;;) {
+        uint64_t head = ULS24_ShmHead(r);
+
+        if (r->cursor >= head) {
+            if (lost) *lost = skipped;
+            return ULS24_ShmState(r) == ULS24_SHM_CLOSED ? -1 : 0;
+        }
+
+        // Lapped: everything older than head - slots + 1 may be gone or going
+        uint64_t oldest = head > r->hdr->slots ? head - r->hdr->slots + 1 : 0;
+        if (r->cursor < oldest) {
+            skipped += oldest - r->cursor;
+            r->cursor = oldest;
+        }
+
+        if (ULS24_ShmRead(r, r->cursor, meta, data)) {
+            r->cursor++;
+            if (lost) *lost = skipped;
+            return 1;
+        }
+
+        skipped++;              // Overwritten under us, move on
+        r->cursor++;
+    }
+}
+
+int ULS24_ShmLatest(const ULS24_ShmReader* r, ULS24_FrameMeta* meta, int* data) {
+    for (int i = 0; i < SHM_READ_RETRIES; i++) {
+        uint64_t head = ULS24_ShmHead(r);
+        if (!head) return 0;
+
+        if (ULS24_ShmRead(r, head - 1, meta, data)) return 1;
+    }
+
+    return 0;
+}
+
+void ULS24_ShmSeek(ULS24_ShmReader* r, uint64_t seq) {
+    r->cursor = seq;
+}
@@ -0,0 +1,74 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// Shared-memory frame ring. The capturing process publishes every frame that
+// enters its history (all captures but melt runs) into a POSIX shared-memory
+// object (ULS24_PublishStart); any number of other processes map it with this
+// reader and copy frames out without syscalls or locks. Readers never block
+// the publisher: a slot being rewritten while it is read is detected through
+// its stamp (seqlock) and the read is retried or reported as overwritten.
+//
+// The reader side is plain C and does not depend on ULSLIB.so or hidapi.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "InterfaceWrapper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ULS24_SHM_MAGIC     0x4d485355      // "USHM"
+#define ULS24_SHM_VERSION   1
+#define ULS24_SHM_PIXELS    (24 * 24)
+#define ULS24_SHM_DEFAULT   "/uls24_frames"
+
+#define ULS24_SHM_LIVE      1
+#define ULS24_SHM_CLOSED    2               // Publisher stopped, reopen to follow a new one
+
+typedef struct {
+    uint32_t magic;             // Written last by the publisher, 0 while initializing
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_bytes;
+    uint32_t state;             // ULS24_SHM_LIVE or ULS24_SHM_CLOSED
+    uint32_t writer_pid;
+    uint64_t next;              // Sequence number of the next frame to be published
+    uint64_t reserved[4];
+} ULS24_ShmHeader;
+
+// Slot seq % slots holds frame seq while stamp == 2 * seq + 2. The publisher
+// sets stamp to 2 * seq + 1 before rewriting the slot.
+
+typedef struct {
+    uint64_t stamp;
+    ULS24_FrameMeta meta;
+    int32_t data[ULS24_SHM_PIXELS];     // meta.size x meta.size row-major
+} ULS24_ShmSlot;
+
+typedef struct ULS24_ShmReader ULS24_ShmReader;
+
+ULS24_ShmReader* ULS24_ShmOpen(const char* name);      // NULL if missing or not initialized yet
+void ULS24_ShmClose(ULS24_ShmReader* r);
+
+uint64_t ULS24_ShmHead(const ULS24_ShmReader* r);      // Sequence number of the next frame to be published
+int ULS24_ShmState(const ULS24_ShmReader* r);          // ULS24_SHM_xxx
+
+// Copies frame seq. data holds ULS24_SHM_PIXELS ints and may be NULL.
+// Returns 1 on success, 0 if seq is not published yet or already overwritten.
+int ULS24_ShmRead(const ULS24_ShmReader* r, uint64_t seq, ULS24_FrameMeta* meta, int* data);
+
+// Sequential consumption. The reader keeps a cursor, initially at the head
+// (only frames published after open). Next copies the frame at the cursor and
+// advances it; if the publisher has lapped the reader the cursor jumps to the
+// oldest frame still available and *lost (may be NULL) counts the skipped ones.
+// Returns 1 for a frame, 0 if none is available yet, -1 if the publisher closed.
+int ULS24_ShmNext(ULS24_ShmReader* r, ULS24_FrameMeta* meta, int* data, uint64_t* lost);
+int ULS24_ShmLatest(const ULS24_ShmReader* r, ULS24_FrameMeta* meta, int* data);   // Newest frame, 0 if none
+void ULS24_ShmSeek(ULS24_ShmReader* r, uint64_t seq);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,195 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#include "stdafx.h"
+
+#include <string.h>
+
+#include "SimDevice.h"
+#include "MonoClock.h"
+
+CSimDevice::CSimDevice()
+{
+	memset(m_Eeprom, 0, sizeof(m_Eeprom));
+	m_Pages = 0;
+	m_Realtime = false;
+	m_ReportNs = SIM_REPORT_US * 1000ull;
+	m_IntTime = 1;
+	m_Noise = 12345;
+	m_Commands = 0;
+	m_Reports = 0;
+}
+
+CSimDevice::~CSimDevice()
+{
+	Detach();
+}
+
+// Page 0 is the short header (id, serial number, channels, wells, pages),
+// followed by NUM_EPKT pages per channel as written by WriteTrimBuff. Every
+// channel gets the first node of the trim file.
+
+int CSimDevice::LoadTrim(const char *path, int channels)
+{
+	CTrimReader reader;
+
+	if (channels < 1 || channels > TRIM_MAX_CHANNELS || !reader.Load((TCHAR*)path))
+		return 0;
+
+	reader.Parse();
+	if (reader.GetNumNode() < 1)
+		return 0;
+
+	reader.Convert2Int(0);
+	reader.WriteTrimBuff(0);
+
+	memset(m_Eeprom, 0, sizeof(m_Eeprom));
+
+	BYTE *h = m_Eeprom[0];
+	h[0] = 0x01;						// Not 0xa5: short header
+	h[1] = 0x04;						// Serial number
+	h[2] = 0x02;
+	h[3] = (BYTE)channels;
+	h[4] = 1;							// Wells
+	h[5] = 1;							// Header pages
+
+	for (int c = 0; c < channels; c++)
+		for (int i = 0; i < NUM_EPKT; i++)
+			memcpy(m_Eeprom[1 + c * NUM_EPKT + i], &reader.Node[0].trim_buff[i * EPKT_SZ], EPKT_SZ);
+
+	m_Pages = 1 + channels * NUM_EPKT;
+
+	for (int p = 0; p < m_Pages; p++) {
+		BYTE parity = 0;
+		for (int j = 0; j < EPKT_SZ; j++)
+			parity += m_Eeprom[p][j];
+		m_Eeprom[p][EPKT_SZ] = parity;
+	}
+
+	return 1;
+}
+
+void CSimDevice::SetTiming(bool realtime, int report_us)
+{
+	m_Realtime = realtime;
+	m_ReportNs = report_us * 1000ull;
+}
+
+void CSimDevice::Attach()
+{
+	HidSimDevice dev;
+	dev.ctx = this;
+	dev.write = OnWrite;
+	dev.read = OnRead;
+
+	m_Queue.clear();
+	HidTraceSimulate(&dev);
+}
+
+void CSimDevice::Detach()
+{
+	HidTraceSimulate(NULL);
+	m_Queue.clear();
+}
+
+void CSimDevice::MakeRow(BYTE *rx, BYTE type, int row, int cols)
+{
+	memset(rx, 0, RxNum);
+
+	rx[0] = 0xaa;
+	rx[2] = GetCmd;
+	rx[4] = type;
+	rx[5] = (BYTE)row;
+
+	for (int i = 0; i < cols; i++) {
+		m_Noise = m_Noise * 1103515245 + 12345;
+		int v = 1200 + row * 8 + i * 4 + (int)((m_Noise >> 16) & 0x3f);		// Gradient plus noise, 12 bit ADC
+
+		rx[i * 2 + 6] = (BYTE)v;
+		rx[i * 2 + 7] = (BYTE)(v >> 8);
+	}
+}
+
+void CSimDevice::Queue(uint64_t ready, const BYTE *rx)
+{
+	Report r;
+	r.ready = ready;
+	r.data[0] = 0;							// Report ID
+	memcpy(r.data + 1, rx, RxNum);
+
+	m_Queue.push_back(r);
+}
+
+int CSimDevice::OnWrite(void *ctx, const char *report)
+{
+	CSimDevice *dev = (CSimDevice *)ctx;
+	const BYTE *tx = (const BYTE *)report + 1;		// TxData
+	BYTE rx[RxNum];
+
+	uint64_t t = MonoTimeNs();
+	if (!dev->m_Queue.empty() && dev->m_Queue.back().ready > t)
+		t = dev->m_Queue.back().ready;				// Commands are handled in order
+
+	dev->m_Commands++;
+
+	if (tx[1] == 0x02) {							// Capture
+		bool full = tx[3] == 0x08;
+		int rows = full ? 24 : 12;
+		BYTE type = full ? 0x08 : tx[3];
+
+		t += (uint64_t)(dev->m_IntTime * 1e6);
+
+		for (int r = 0; r < rows; r++) {
+			dev->MakeRow(rx, type, r, rows);
+			t += dev->m_ReportNs;
+			dev->Queue(t, rx);
+		}
+	}
+	else if (tx[1] == 0x04 && tx[3] == 0x2d) {		// EEPROM read from page tx[4]
+		for (int p = tx[4]; p < dev->m_Pages; p++) {
+			memset(rx, 0, sizeof(rx));
+			rx[0] = 0xaa;
+			rx[2] = ReadCmd;
+			rx[4] = 0x2d;
+			rx[6] = (BYTE)dev->m_Pages;
+			rx[7] = (BYTE)p;
+			memcpy(rx + 8, dev->m_Eeprom[p], EPKT_SZ + 1);
+
+			t += dev->m_ReportNs;
+			dev->Queue(t, rx);
+		}
+	}
+	else {											// Settings: one acknowledge
+		if (tx[1] == 0x01 && tx[3] == 0x20)
+			memcpy(&dev->m_IntTime, tx + 4, sizeof(float));
+
+		memset(rx, 0, sizeof(rx));
+		rx[0] = 0xaa;
+		rx[2] = tx[1];
+		rx[4] = tx[3];
+
+		t += dev->m_ReportNs;
+		dev->Queue(t, rx);
+	}
+
+	return HIDREPORTNUM;
+}
+
+int CSimDevice::OnRead(void *ctx, char *report)
+{
+	CSimDevice *dev = (CSimDevice *)ctx;
+
+	if (dev->m_Queue.empty())
+		return 0;									// Nothing outstanding: timeout
+
+	const Report &r = dev->m_Queue.front();
+
+	if (dev->m_Realtime)
+		SleepUntilNs(r.ready);
+
+	memcpy(report, r.data, HIDREPORTNUM);
+	dev->m_Queue.pop_front();
+	dev->m_Reports++;
+
+	return HIDREPORTNUM;
+}
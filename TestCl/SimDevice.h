@@ -0,0 +1,76 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+
+#include "HidTrace.h"
+#include "TrimReader.h"
+
+// Simulated ULS24 for benchmarks and hardware-free runs. Attached through
+// HidTraceSimulate, it answers settings commands with an acknowledge, the
+// EEPROM read with a trim image and capture commands with row reports of
+// synthetic pixels, so everything above WriteHIDOutputReport and
+// ReadHIDInputReport runs unmodified.
+//
+// In real-time mode reports become available when the device would send them:
+// a capture's first row after the integration time plus one report interval,
+// every other report one interval after the previous one. Otherwise reads
+// return immediately and only host cost is measured.
+
+#define SIM_CHANNELS		4				// Default channel count of the EEPROM image
+#define SIM_EEPROM_PAGES	(1 + TRIM_MAX_CHANNELS * NUM_EPKT)
+#define SIM_REPORT_US		1000			// Full-speed interrupt endpoint, one report per frame
+
+class CSimDevice {
+
+protected:
+
+	struct Report {
+		uint64_t	ready;					// MonoTimeNs
+		BYTE		data[HIDREPORTNUM];
+	};
+
+	std::deque<Report> m_Queue;
+
+	BYTE		m_Eeprom[SIM_EEPROM_PAGES][EPKT_SZ + 1];
+	int			m_Pages;
+
+	bool		m_Realtime;
+	uint64_t	m_ReportNs;
+	float		m_IntTime;					// ms, from the last SetIntTime command
+	uint32_t	m_Noise;
+
+	uint64_t	m_Commands;
+	uint64_t	m_Reports;
+
+public:
+
+	CSimDevice();
+	~CSimDevice();
+
+	int  LoadTrim(const char *path, int channels = SIM_CHANNELS);	// EEPROM image from a trim file, 1: success
+	void SetTiming(bool realtime, int report_us = SIM_REPORT_US);
+
+	void Attach();							// Replace the device until Detach
+	void Detach();
+
+	uint64_t GetCommands() { return m_Commands; }
+	uint64_t GetReports() { return m_Reports; }
+
+	// Eeprom pages as the device would send them (EPKT_SZ data bytes + parity)
+	const BYTE (*GetEeprom() const)[EPKT_SZ + 1] { return m_Eeprom; }
+	int  GetEepromPages() const { return m_Pages; }
+
+	// One row report of a capture, as ReadHIDInputReport stores it in RxData
+	void MakeRow(BYTE *rx, BYTE type, int row, int cols);
+
+protected:
+
+	static int OnWrite(void *ctx, const char *report);
+	static int OnRead(void *ctx, char *report);
+
+	void Queue(uint64_t ready, const BYTE *rx);
+};
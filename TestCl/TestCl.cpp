@@ -5,6 +5,7 @@
 #include "TestCl.h"
 #include "InterfaceObj.h"
 #include "HidMgr.h"
+#include "HidTrace.h"
 
 #include <iostream>
 #include <string>
@@ -40,17 +41,33 @@ int _tmain(int argc, TCHAR* argv[], TCHAR* envp[])
 		}
 		else
 		{
-			// TODO: code your application's behavior here.
+			// -trace file records all HID reports; -replay file [-fast] runs from such a recording
+			string trace, replay;
+			bool fast = false;
+
+			for (int i = 1; i < argc; i++) {
+				string arg, val;
+				for (TCHAR *p = argv[i]; *p; p++) arg += (char)*p;
+				if (i + 1 < argc)
+					for (TCHAR *p = argv[i + 1]; *p; p++) val += (char)*p;
+
+				if (arg == "-trace" && i + 1 < argc) { trace = val; i++; }
+				else if (arg == "-replay" && i + 1 < argc) { replay = val; i++; }
+				else if (arg == "-fast") fast = true;
+			}
+
+			if (!replay.empty() && !HidTraceReplay(replay.c_str(), fast ? HIDTRACE_FAST : HIDTRACE_REALTIME))
+				cout << "Cannot read trace " << replay << endl;
+			if (!trace.empty() && !HidTraceStart(trace.c_str()))
+				cout << "Cannot create trace " << trace << endl;
+
 			bool DeviceFound = FindTheHID();
 
 			if(DeviceFound) {
 
 	//			int e = theInterfaceObject.LoadTrimFile();
 
-				if(true) {
-					theInterfaceObject.ReadTrimData();
-					theInterfaceObject.ResetTrim();				// Always do this after loading trim file.
-
+				if(!theInterfaceObject.ReadTrimData()) {		// Resets the trim as well
 					theInterfaceObject.SelSensor(1);
 					theInterfaceObject.SetIntTime(30);			// 10ms
 					theInterfaceObject.SetGainMode(1);			// high gain mode
@@ -64,7 +81,7 @@ int _tmain(int argc, TCHAR* argv[], TCHAR* envp[])
 				cout << "Device not found" << endl;
 			}
 
-			cout << "allowable commands are: selchan, get, setinttime, setgain, reset, exit..." << endl;
+			cout << "allowable commands are: selchan, get, setinttime, setgain, record, stoprec, reset, exit..." << endl;
 			cout << ">";
 
 			string cmd;
@@ -110,6 +127,24 @@ int _tmain(int argc, TCHAR* argv[], TCHAR* envp[])
 					theInterfaceObject.SetGainMode(gain);
 				}
 
+				c = cmd.compare("record");
+
+				if (c == 0) {
+					string prefix;
+					cout << "file prefix: ";
+					cin >> prefix;
+					if (theInterfaceObject.GetRecorder().Open(prefix.c_str()))
+						cout << "Recording every frame to " << prefix << ".NNNNN.ulsr" << endl;
+					else
+						cout << "Cannot create " << prefix << ".00000.ulsr" << endl;
+				}
+
+				c = cmd.compare("stoprec");
+
+				if (c == 0) {
+					theInterfaceObject.GetRecorder().Close();
+				}
+
 				c = cmd.compare("reset");
 
 				if (c == 0) {
@@ -123,6 +158,9 @@ int _tmain(int argc, TCHAR* argv[], TCHAR* envp[])
 				res = cmd.compare("exit");
 			}
 
+			theInterfaceObject.GetRecorder().Close();
+			HidTraceStop();
+
 			cout << "Press any key and then return to end..." << endl;
 			cin.get();
 		}
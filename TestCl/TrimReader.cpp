@@ -4,6 +4,9 @@
 #include "stdafx.h"
 #include "TrimReader.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 
 #define SAW_TOOTH2		// Newer Sawtooth algorithm. USe 2 pass low byte correction
 #define NON_CONTIGUOUS
@@ -13,8 +16,6 @@ extern BYTE RxData[];		// the buffer of received data from COMX
 
 extern int chan_num;
 
-BYTE EepromBuff[16 + 4 * NUM_EPKT][EPKT_SZ + 1];		// 16 pages maximum - enough to support 16 well 4 channel.
-
 
 // Node
 
@@ -39,6 +40,12 @@ CTrimNode::Initialize()
 		fpn[0][i] = 0;
 		fpn[1][i] = 0;
 
+		for (int j = 0; j < 6; j++)
+			kbi[i][j] = 0;
+
+		fpni[0][i] = 0;
+		fpni[1][i] = 0;
+
 		if (!i) tempcal[i] = 1;
 		else tempcal[i] = 0;
 	}
@@ -54,81 +61,115 @@ CTrimNode::Initialize()
 
 	tbuff_size = 0;
 	tbuff_rptr = 0;
+
+	pending = false;
 }
 
 // Reader
 
+const CTrimNode CTrimReader::DefaultNode;
+
 CTrimReader::CTrimReader() 
 { 
 //	InFile = 0; 
 	curNode = NULL;
 	NumNode = 0;
 
-	WordIndex = 0;
+	m_Pos = 0;
+	m_Word = "";
+	m_WordLen = 0;
 
 	fileLoaded = false;
+
+	BeginEEPROMRead();
 }
 
 CTrimReader::~CTrimReader() 
 {
-	if(fileLoaded) InFile.Close();
 }
 
-int CTrimReader::Load(TCHAR* fn) 
+void CTrimReader::SetNumNode(int n)
 {
-	int e;
-	CString FileBuf;
+	Node.resize(n);
+	NumNode = n;
+}
 
-	e = InFile.Open(fn, CFile::modeRead);
+// The file is read in one piece and closed; words are found by GetWord as
+// Parse asks for them, so loading is linear in the file size and there is no
+// limit on the number of words.
 
-	fileLoaded = e;
+int CTrimReader::Load(TCHAR* fn) 
+{
+	m_Text.clear();
+	m_Pos = 0;
+	m_Word = "";
+	m_WordLen = 0;
 
-	if(!e) return e;
+	fileLoaded = false;
+
+	if (!InFile.Open(fn, CFile::modeRead))
+		return 0;
 
 	DWORD fl = InFile.GetLength();
 
-	char *buf = new char[fl];
+	m_Text.resize(fl + 1);
 
-	InFile.Read(buf, fl);
+	UINT n = fl ? InFile.Read(&m_Text[0], fl) : 0;
 
-	FileBuf = buf;
+	m_Text.resize(n + 1);
+	m_Text[n] = 0;
 
-	delete buf;
+	InFile.Close();
 
-	int ep;
+	fileLoaded = true;
 
-	CString delimit = CString(", \t\r\n");
+	return 1;
+}
 
-	int i = 0;
+static inline bool IsDelimiter(char c)
+{
+	return c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
 
-	FileBuf.TrimLeft(delimit);
+int CTrimReader::GetWord()
+{
+	m_Word = "";
+	m_WordLen = 0;
 
-	while (((ep = FileBuf.FindOneOf(delimit)) != -1) && i < TRIM_MAX_WORD) 
-	{
-		WordBuf[i] = FileBuf.Mid(0, ep);
-		int l = FileBuf.GetLength();
-		FileBuf = FileBuf.Mid(ep, (l - ep));
-		FileBuf.TrimLeft(delimit);
-		i++;
-	}
-	
-	MaxWord = i;
-	FileBuf.Empty();
+	if (m_Text.empty())
+		return 0;
+
+	const char *p = &m_Text[m_Pos];
+
+	while (*p && IsDelimiter(*p))
+		p++;
+
+	const char *e = p;
+
+	while (*e && !IsDelimiter(*e))
+		e++;
+
+	m_Pos = e - &m_Text[0];
+
+	if (e == p)
+		return 0;
+
+	m_Word = p;
+	m_WordLen = e - p;
 
-	return e;
+	return 1;
 }
 
-int CTrimReader::GetWord()
+int CTrimReader::Match(const char *s)
 {
-	CurWord = WordBuf[WordIndex];
-	WordIndex++;
-
-	return WordIndex;
+	return (int)(strncmp(m_Word, s, m_WordLen) == 0 && s[m_WordLen] == 0);
 }
 
-int CTrimReader::Match(CString s)
+// Same result as atof on the word alone: strtod stops at the delimiter.
+
+double CTrimReader::WordToDouble()
 {
-	return (int)(CurWord.Compare(s) == 0);
+	return m_WordLen ? strtod(m_Word, NULL) : 0;
 }
 
 void CTrimReader::Parse()
@@ -136,20 +177,23 @@ void CTrimReader::Parse()
 	CString Name;
 	int i = 0;
 
-	if(!InFile) 
+	if(!fileLoaded) 
 		return;
 
 	for(;;) {		
-		if(GetWord() == MaxWord) 
+		if(!GetWord() || i == TRIM_MAX_CHANNELS) 
 			break;		
 		
-		if(Match(CString("DEF"))) {
+		if(Match("DEF")) {
 			GetWord();
-			Name = CurWord;
+			Name = CString(std::string(m_Word, m_WordLen).c_str());
 			
 			GetWord();
-			if(Match(CString("{"))) {
-				curNode = Node + i;
+			if(Match("{")) {
+				if (i >= (int)Node.size())
+					Node.resize(i + 1);
+				curNode = &Node[i];
+				curNode->pending = false;
 				i++;
 				curNode->name = Name;
 				ParseNode();
@@ -159,108 +203,108 @@ void CTrimReader::Parse()
 		else break;
 	}
 
-	NumNode = i;
+	SetNumNode(i);
 }
 
 
 void CTrimReader::ParseNode()
 {
-	if(!InFile) 
+	if(!fileLoaded) 
 		return;
 
 	for(;;) {		
-		if(GetWord() == MaxWord) 
+		if(!GetWord()) 
 			break;		
 		
-		if(Match(CString("Kb"))) {
+		if(Match("Kb")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseMatrix();
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("Fpn_lg"))) {
+		else if(Match("Fpn_lg")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseArray(0);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}		
-		else if(Match(CString("Fpn_hg"))) {
+		else if(Match("Fpn_hg")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseArray(1);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("Temp_calib"))) {
+		else if(Match("Temp_calib")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseArray(2);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}		
-		else if(Match(CString("Rampgen"))) {
+		else if(Match("Rampgen")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseValue(2);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("AutoV20_lg"))) {
+		else if(Match("AutoV20_lg")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseValue(0);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("AutoV20_hg"))) {
+		else if(Match("AutoV20_hg")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseValue(1);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("AutoV15"))) {
+		else if(Match("AutoV15")) {
 			GetWord();
-			if(Match(CString("{"))) {
+			if(Match("{")) {
 				ParseValue(3);
 
 				GetWord();
-				if(!Match(CString("}"))) 
+				if(!Match("}")) 
 					return;
 			}
 			else return;
 		}
-		else if(Match(CString("}"))) {
+		else if(Match("}")) {
 			return;
 		}
 		else 
@@ -272,9 +316,9 @@ void CTrimReader::ParseMatrix()
 {
 	for(int i=0; i<TRIM_IMAGER_SIZE; i++) {
 		for(int j=0; j<4; j++) {
-			if(GetWord() == MaxWord) 
+			if(!GetWord()) 
 				break;
-			curNode->kb[i][j] = _tstof((LPCTSTR)CurWord); // atof(CurWord);
+			curNode->kb[i][j] = WordToDouble();
 		}
 	}
 }
@@ -285,9 +329,9 @@ void CTrimReader::ParseArray(int gain)
 	for(int i=0; i<12; i++) {
 		GetWord();	
 		if(gain == 2) 
-			curNode->tempcal[i] = _tstof((LPCTSTR)CurWord);
+			curNode->tempcal[i] = WordToDouble();
 		else 
-			curNode->fpn[gain][i] = _tstof((LPCTSTR)CurWord);
+			curNode->fpn[gain][i] = WordToDouble();
 	}
 }
 
@@ -297,14 +341,18 @@ void CTrimReader::ParseArray(int gain)
 {
 	GetWord();
 
-	CString word = CurWord;
-	word.MakeLower();
-	int p = word.Find(CString("0x"));
-	int l = word.GetLength();
-	word = word.Mid(p+2, l-p-2);
-	unsigned int val = _tstoi((LPCTSTR)word);
+	// Hex digits after "0x" (either case)
+
+	size_t p = 0;
 
-	val =  _tcstoul((LPCTSTR)word, 0, 16);
+	for (size_t i = 0; i + 1 < m_WordLen; i++) {
+		if (m_Word[i] == '0' && (m_Word[i + 1] == 'x' || m_Word[i + 1] == 'X')) {
+			p = i + 2;
+			break;
+		}
+	}
+
+	unsigned int val = p < m_WordLen ? (unsigned int)strtoul(m_Word + p, 0, 16) : 0;
 
 	if(gain == 2)
 		curNode->rampgen = val;
@@ -314,7 +362,6 @@ void CTrimReader::ParseArray(int gain)
 		curNode->auto_v20[gain] = val;
 }
 
-#define DARK_LEVEL 100
 #define DARK_MANAGE
  
  // NumData =  "Column Number"
@@ -338,12 +385,14 @@ void CTrimReader::ParseArray(int gain)
 	if(pixelNum == 12) nd = NumData;
 	else nd = NumData >> 1;
 
-	ioffset = Node[PCRNum-1].kb[nd][0] * (double)hb + Node[PCRNum-1].kb[nd][1];
+	const CTrimNode &node = GetNode(PCRNum - 1);
+
+	ioffset = node.kb[nd][0] * (double)hb + node.kb[nd][1];
 
 #ifdef NON_CONTIGUOUS
 
 	if(hb >= 128) {
-		ioffset += Node[PCRNum-1].kb[nd][3];
+		ioffset += node.kb[nd][3];
 	}
 
 #endif
@@ -354,7 +403,7 @@ void CTrimReader::ParseArray(int gain)
 		
 #ifdef SAW_TOOTH		
 
-		ioffset += Node[PCRNum-1].kb[nd][2] * (hbln - 7);
+		ioffset += node.kb[nd][2] * (hbln - 7);
 
 #endif
 
@@ -365,7 +414,7 @@ void CTrimReader::ParseArray(int gain)
 	lbc = lb + (int)ioffset;
 
 #ifdef SAW_TOOTH2							// Use lbc, not hbln to calculate sawtooth correction, as hbln tends to be a little unstable	
-		ioffset += Node[PCRNum-1].kb[nd][2] * ((double)lbc - 127) * (1 - (double)hb / 400) / 16;		// 12/19/2016 modification, shrinking sawtooth.
+		ioffset += node.kb[nd][2] * ((double)lbc - 127) * (1 - (double)hb / 400) / 16;		// 12/19/2016 modification, shrinking sawtooth.
 		lbc = lb + (int)ioffset;					// re-calc lbc, 2 pass algorithm
 #endif
 		
@@ -417,9 +466,9 @@ void CTrimReader::ParseArray(int gain)
 #ifdef DARK_MANAGE
 
 	if(!gain_mode)
-		result += -(int) (Node[PCRNum-1].fpn[1][nd]) + DARK_LEVEL;		// high gain
+		result += -(int) (node.fpn[1][nd]) + DARK_LEVEL;		// high gain
 	else 
-		result += -(int) (Node[PCRNum-1].fpn[0][nd]) + DARK_LEVEL;		// low gain
+		result += -(int) (node.fpn[0][nd]) + DARK_LEVEL;		// low gain
 
 	if(result < 0) result = 0;
 
@@ -430,7 +479,7 @@ void CTrimReader::ParseArray(int gain)
 
 // This is the integer version of the auto correct function
 
-int CTrimReader::ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pixelNum, int PCRNum, int gain_mode, int* flag)
+int CTrimReader::ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pixelNum, int PCRNum, int gain_mode, int* flag) const
 {
 	int hb, lb, lbc, hbi;
 	int hbln, lbp, hbhn;
@@ -450,25 +499,27 @@ int CTrimReader::ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pi
 	if (pixelNum == 12) nd = NumData;
 	else nd = NumData >> 1;
 
+	const CTrimNode &node = GetNode(PCRNum - 1);
+
 	int k, b, c, h;
 
 	//	double shrink = 0.022;
 
-	c = (int)(Node[PCRNum - 1].kbi[nd][4]);
-	h = (int)(Node[PCRNum - 1].kbi[nd][5]);
+	c = (int)(node.kbi[nd][4]);
+	h = (int)(node.kbi[nd][5]);
 
 	if (hb < 16) {
-		k = (int)(Node[PCRNum - 1].kbi[nd][0]);
-		b = (int)(Node[PCRNum - 1].kbi[nd][1]) + h / 2;			// 15 is just an empirical value, the first bump is raised higher. To do: what about reverse bump
+		k = (int)(node.kbi[nd][0]);
+		b = (int)(node.kbi[nd][1]) + h / 2;			// 15 is just an empirical value, the first bump is raised higher. To do: what about reverse bump
 		c = c + h / 10;
 	}
 	else if (hb < 128) {
-		k = (int)(Node[PCRNum - 1].kbi[nd][0]);
-		b = (int)(Node[PCRNum - 1].kbi[nd][1]);					// 
+		k = (int)(node.kbi[nd][0]);
+		b = (int)(node.kbi[nd][1]);					// 
 	}
 	else {
-		k = (int)(Node[PCRNum - 1].kbi[nd][2]);
-		b = (int)(Node[PCRNum - 1].kbi[nd][3]);					// 
+		k = (int)(node.kbi[nd][2]);
+		b = (int)(node.kbi[nd][3]);					// 
 	}
 
 	ioffset = k * hb / intmax + b / intmax256;
@@ -535,9 +586,9 @@ int CTrimReader::ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pi
 #ifdef DARK_MANAGE
 
 	if (!gain_mode)
-		result += -(int)(Node[PCRNum - 1].fpni[1][nd]) + DARK_LEVEL;		// high gain
+		result += -(int)(node.fpni[1][nd]) + DARK_LEVEL;		// high gain
 	else
-		result += -(int)(Node[PCRNum - 1].fpni[0][nd]) + DARK_LEVEL;		// low gain
+		result += -(int)(node.fpni[0][nd]) + DARK_LEVEL;		// low gain
 
 	if (result < 0) result = 0;
 
@@ -827,46 +878,93 @@ void CTrimReader::SelSensor(BYTE i)
 #define dppage12 0x02		// display one page with 12 pixel
 #define dppage24 0x08		// display one page with 24 pixel
 
-int CTrimReader::ProcessRowData(int (*adc_data)[24], int gain_mode)
+int CTrimReader::ProcessRowData(int (*adc_data)[24], int gain_mode) const
 {
-	int result;
+	return ProcessRowData(adc_data, gain_mode, NULL);
+}
 
-	int flag, ncol=12;
+int CTrimReader::ProcessRowData(int (*adc_data)[24], int gain_mode, const int *dark) const
+{
+	CorrectRow(RxData, chan_num, gain_mode, &adc_data[0][0], 24, dark);
 
-	int FrameSize=0;
+	return (RxData[4] == dppage24) ? 1 : 0;		// 0: 12x12 frame; 1: 24x24 frame
+}
 
- 	BYTE type = RxData[4];	//
+// Corrects one row report into frame[row * stride + col], a dim x dim frame.
+// The row number is taken from the report; a report of another frame size is
+// dropped. If dark is given (a compact dim x dim reference frame) its excess
+// over DARK_LEVEL is subtracted as well. Returns the number of columns
+// written, 0 if the report does not carry a valid row. flags, if given,
+// receives each pixel's ADCCorrectioni over/underflow code at the same
+// offsets as frame.
 
- 	switch(type)
- 	{
- 	case dppage12:		// 
- 		ncol = 12;
-		FrameSize = 0;
- 		break;
+template <typename T>
+int CTrimReader::CorrectRowT(const BYTE *rx, int chan, int gain_mode, T *frame, int dim, int stride, const int *dark, BYTE *flags) const
+{
+	int result;
+
+	int flag;
+	int ncol = ReportCols(rx);
 
- 	case dppage24:		// 
- 		ncol = 24;
-		FrameSize = 1;
- 		break;
+	unsigned int rn = rx[5];
 
- 	default: 
- 		break;
- 	}
+	if (ncol != dim || dim > stride)
+		return 0;
 
+	if (rn >= (unsigned int)ncol || chan < 1 || chan > TRIM_MAX_CHANNELS)	// e.g. the 0xf1 end code
+		return 0;
+
+	T *row = frame + rn * stride;
+	const int *dark_row = dark ? dark + rn * dim : NULL;
+	BYTE *flag_row = flags ? flags + rn * stride : NULL;
 
 	for (int i=0; i<ncol; i++)
  	{
- 		result = ADCCorrectioni(i, RxData[i*2+7], RxData[i*2+6], ncol, chan_num, gain_mode, &flag);	// data stride is 2
- 		
- 		unsigned int rn = RxData[5];
- 		unsigned int cn = i;
+ 		result = ADCCorrectioni(i, rx[i*2+7], rx[i*2+6], ncol, chan, gain_mode, &flag);	// data stride is 2
+
+		if (flag_row)
+			flag_row[i] = (BYTE)flag;
 
- 		adc_data[rn][cn] = result;
+		if (dark_row)
+			result -= dark_row[i] - DARK_LEVEL;
 
- 		if(adc_data[rn][cn] < 0) adc_data[rn][cn] = 0;
+ 		row[i] = (T)(result < 0 ? 0 : result);				// Corrected values are 16 bit at most
 	}
 
-	return FrameSize;
+	return ncol;
+}
+
+template int CTrimReader::CorrectRowT<int>(const BYTE *, int, int, int *, int, int, const int *, BYTE *) const;
+template int CTrimReader::CorrectRowT<uint16_t>(const BYTE *, int, int, uint16_t *, int, int, const int *, BYTE *) const;
+
+// For a frame buffer of stride x stride that takes either report size; dark
+// must match the report's size
+
+int CTrimReader::CorrectRow(const BYTE *rx, int chan, int gain_mode, int *frame, int stride, const int *dark) const
+{
+	return CorrectRowT<int>(rx, chan, gain_mode, frame, ReportCols(rx), stride, dark);
+}
+
+// Differential variant: frame already holds the LED-on frame, and the corrected
+// LED-off row in rx is subtracted from it in place. FPN and DARK_LEVEL cancel.
+// Each operand is clamped at 0 by the correction, their difference is not, so
+// the result is signed.
+
+int CTrimReader::CorrectRowDiff(const BYTE *rx, int chan, int gain_mode, int *frame, int stride) const
+{
+	int flag;
+	int ncol = ReportCols(rx);
+	unsigned int rn = rx[5];
+
+	if (ncol > stride || rn >= (unsigned int)ncol || chan < 1 || chan > TRIM_MAX_CHANNELS)
+		return 0;
+
+	int *row = frame + rn * stride;
+
+	for (int i = 0; i < ncol; i++)
+		row[i] -= ADCCorrectioni(i, rx[i * 2 + 7], rx[i * 2 + 6], ncol, chan, gain_mode, &flag);
+
+	return ncol;
 }
 
 BYTE CTrimReader::TrimBuff2Byte()
@@ -881,15 +979,19 @@ BYTE CTrimReader::TrimBuff2Byte()
 
 void CTrimReader::CopyEepromBuffAndRestore()
 {
-	for (int j = 0; j < EPKT_SZ; j++) {			// parity not copied
-		trim_buff[j] = EepromBuff[0][j];		// copy first page
-	}
+	if (!ee_npages)
+		return;
+
+	trim_buff.assign(EEPage(0), EEPage(0) + EPKT_SZ);		// copy first page, parity not copied
 
 	RestoreFromTrimBuff();
 
-	for (int i = 1; i < num_pages; i++) {
+	int npages = num_pages < ee_npages ? num_pages : ee_npages;
+	trim_buff.resize(npages > 1 ? npages * EPKT_SZ : EPKT_SZ);
+
+	for (int i = 1; i < npages; i++) {
 		for (int j = 0; j < EPKT_SZ; j++) {			// parity not copied
-			trim_buff[i * EPKT_SZ + j] = EepromBuff[i][j];
+			trim_buff[i * EPKT_SZ + j] = EEPage(i)[j];
 		}
 	}
 }
@@ -937,47 +1039,104 @@ void CTrimReader::RestoreFromTrimBuff()
 
 extern BOOL ee_continue;
 
-void CTrimReader::OnEEPROMRead()
+// EEPROM readout. The device answers an EEPROM read with one report per page,
+// from the requested start page to its last page; RxData[6] is the number of
+// pages and RxData[7] the page index. A page with the right parity is kept at
+// the index it carries, so a dropped report costs only its own page. Neither
+// byte is covered by the parity: the page count is taken from the first good
+// page and checked against the header page once that is in, and a report with
+// a different count is rejected. The stream ends with the report of the last
+// page, or after as many reports as the stream has pages (ee_start to the
+// last) if that one is lost. Once the header page is in, only the pages the
+// calibration uses (ee_needed) must be valid, and EEPROMMissingPage tells the
+// caller where to restart a readout.
+
+void CTrimReader::BeginEEPROMRead()
 {
-		// EEPROM data, check parity here too.
+	ee_buff.clear();
+	ee_npages = 0;
+	ee_needed = 0;
+	ee_start = 0;
+	ee_count = 0;
+	ee_errors = 0;
+}
+
+int CTrimReader::OnEEPROMRead()
+{
+	int npages = RxData[6];
+	int index = RxData[7];		// For command type 2d EEPROM read command
+
+	ee_count++;
+
+	BYTE eeprom_parity = 0;
+	for (int i = 0; i < EPKT_SZ; i++)
+		eeprom_parity += RxData[8 + i];
+
+	bool good = eeprom_parity == RxData[8 + EPKT_SZ] && npages >= 1;
+
+	if (good && !ee_npages) {
+		ee_npages = npages;
+		ee_buff.assign(npages * (EPKT_SZ + 2), 0);
+	}
 
-		BYTE eeprom_parity = 0;
-		int index = RxData[7];		// For command type 2d EEPROM read command
-		int npages = RxData[6];
-		bool parity_ok = true;
+	if (good && npages == ee_npages && index < ee_npages) {
+		memcpy(EEPage(index), &RxData[8], EPKT_SZ + 1);
 
-		for (int i = 0; i < EPKT_SZ + 1; i++) {		// 
-			EepromBuff[index][i] = RxData[8 + i];
+		if (index == 0) {
+			trim_buff.assign(EEPage(0), EEPage(0) + EPKT_SZ);
+			RestoreFromTrimBuff();
 
-			if (i < EPKT_SZ) {
-				eeprom_parity += RxData[8 + i];
+			int needed = num_pages + num_channels * NUM_EPKT;
+
+			if (num_pages >= 1 && num_channels >= 1 && num_channels <= TRIM_MAX_CHANNELS && needed <= ee_npages) {
+				ee_needed = needed;
+				EEValid(0) = 1;
 			}
 			else {
-				if (eeprom_parity != RxData[8 + i]) {
-//					MessageBox(_T("Packet parity error!"));
-					parity_ok = false;
-				}
+				ee_errors++;	// Impossible contents, or a page count too small for them
+				ee_npages = 0;	// Taken again from the next good page
+				ee_needed = 0;
+				ee_buff.clear();
 			}
 		}
+		else
+			EEValid(index) = 1;
+	}
+	else if (!ee_needed || index < ee_needed)
+		ee_errors++;
 
+	// Without a page count the end of the stream is unknown; keep reading
+	// until a report supplies one, or the one byte page index runs out.
 
-		if (index < npages - 1)
-			ee_continue = true;
-		else
-			ee_continue = false;
+	if (ee_npages)
+		ee_continue = index != ee_npages - 1 && ee_count < ee_npages - ee_start;
+	else
+		ee_continue = ee_count < EE_MAX_PAGES - ee_start;
 
-		
+	if (!ee_continue)
+		ee_count = 0;
 
+	return ee_continue;
 }
 
+int CTrimReader::EEPROMMissingPage()
+{
+	int n = ee_needed ? ee_needed : 1;		// Header page first
+
+	for (int i = 0; i < n; i++)
+		if (i >= ee_npages || !EEValid(i))
+			return i;
+
+	return -1;
+}
 
-void CTrimReader::EEPROMRead()
+void CTrimReader::EEPROMRead(BYTE start)
 {
 	TxData[0] = 0xaa;					//preamble code
 	TxData[1] = 0x04;					//command
 	TxData[2] = 0x02;					//data length
 	TxData[3] = 0x2d;					//data type
-	TxData[4] = (BYTE)0x0;			//	real data
+	TxData[4] = start;					//	real data: first page to send
 									//	TxData[5] = 0x00;
 	TxData[5] = TxData[1] + TxData[2] + TxData[3] + TxData[4];		//check sum
 	if (TxData[5] == 0x17)
@@ -986,24 +1145,90 @@ void CTrimReader::EEPROMRead()
 		TxData[5] = TxData[5];
 	TxData[6] = 0x17;		//back code
 	TxData[7] = 0x17;		//back code
+
+	ee_start = start;
+	ee_count = 0;
 }
 
-void CTrimReader::ReadTrimData()
+// Nodes are copied out of the readout buffer, which is then released so the
+// reader (and every calibration set copied from it) only holds the nodes.
+
+int CTrimReader::ReadTrimData()
 {
+	if (!ee_npages)
+		return 0;
+
+	int n = ReadTrimData((const BYTE (*)[EPKT_SZ + 1])EEPage(0), ee_npages);
 
-	CopyEepromBuffAndRestore();			// Compare with with g_DPReader.
+	if (n) {
+		BeginEEPROMRead();
+		std::vector<BYTE>().swap(ee_buff);
+	}
+
+	return n;
+}
+
+// Restores the header from EEPROM pages supplied by the caller (EPKT_SZ data
+// bytes + parity each) and copies each channel's pages into its node, to be
+// decoded by RestoreNode. Returns the number of nodes, or 0 if the header asks
+// for more pages or channels than eeprom holds, or a page it uses fails its
+// parity.
+
+int CTrimReader::ReadTrimData(const BYTE (*eeprom)[EPKT_SZ + 1], int eeprom_pages)
+{
+	if (eeprom_pages < 1)
+		return 0;
+
+	trim_buff.assign(eeprom[0], eeprom[0] + EPKT_SZ);		// copy first page, parity not copied
+
+	RestoreFromTrimBuff();
 
 	int nchannels = num_channels;
-	 int npages = num_pages;
-	
+	int npages = num_pages;
+
+	if (nchannels > TRIM_MAX_CHANNELS || npages + nchannels * NUM_EPKT > eeprom_pages)
+		return 0;
+
+	for (int i = 0; i < npages + nchannels * NUM_EPKT; i++) {
+		BYTE parity = 0;
+		for (int j = 0; j < EPKT_SZ; j++)
+			parity += eeprom[i][j];
+		if (parity != eeprom[i][EPKT_SZ])
+			return 0;
+	}
+
+	trim_buff.resize(npages > 1 ? npages * EPKT_SZ : EPKT_SZ);
+
+	for (int i = 1; i < npages; i++) {
+		for (int j = 0; j < EPKT_SZ; j++) {
+			trim_buff[i * EPKT_SZ + j] = eeprom[i][j];
+		}
+	}
 
-	NumNode = nchannels;
+	SetNumNode(nchannels);
 
 	for (int i = 0; i < nchannels; i++) {
-		CopyEepromBuff(i, npages + i * NUM_EPKT);
-		RestoreTrimBuff(i);
+		CopyEepromBuff(i, npages + i * NUM_EPKT, eeprom);
+		Node[i].pending = true;
 		Node[i].version = 3;				// So it will use integer version KB matrix and FPN values
 	}
+
+	return nchannels;
+}
+
+void CTrimReader::RestoreNode(int k)
+{
+	if (!IsNodePending(k))
+		return;
+
+	RestoreTrimBuff(k);
+	Node[k].pending = false;
+}
+
+void CTrimReader::RestoreNodes()
+{
+	for (int k = 0; k < NumNode; k++)
+		RestoreNode(k);
 }
 
 // EEProm buffer related stuff
@@ -1176,11 +1401,17 @@ void  CTrimReader::RestoreTrimBuff(int k)
 //#endif
 
 void  CTrimReader::CopyEepromBuff(int k, int index_start)
+{
+	if (index_start + NUM_EPKT <= ee_npages)
+		CopyEepromBuff(k, index_start, (const BYTE (*)[EPKT_SZ + 1])EEPage(0));
+}
+
+void  CTrimReader::CopyEepromBuff(int k, int index_start, const BYTE (*eeprom)[EPKT_SZ + 1])
 {
 	//#ifdef CALIB_PROGRAM
 	for (int i = 0; i < NUM_EPKT; i++) {
 		for (int j = 0; j < EPKT_SZ; j++) {			// parity not copied
-			Node[k].trim_buff[i * EPKT_SZ + j] = EepromBuff[i + index_start][j];
+			Node[k].trim_buff[i * EPKT_SZ + j] = eeprom[i + index_start][j];
 		}
 	}
 	//#endif
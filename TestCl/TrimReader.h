@@ -4,12 +4,19 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 #define TRIM_IMAGER_SIZE 12
 #define MAX_TRIMBUFF 256
 
+#define DARK_LEVEL 100				// Pedestal added after FPN subtraction
+
 #define EPKT_SZ  52					// Not include parity, made it 52 instead of 51 for qPCR version
 #define NUM_EPKT 4
+#define EE_MAX_PAGES 255			// Page count and index are one byte in the EEPROM reports
+
+#define TRIM_MAX_CHANNELS 16		// The channel is the high nibble of a row report's type byte
 
 class CTrimNode {
 
@@ -35,6 +42,8 @@ public:
 	int		tbuff_size;
 	int		tbuff_rptr;
 
+	bool	pending;					// trim_buff copied from EEPROM but not yet decoded, see CTrimReader::RestoreNode
+
 public:
 
 	CTrimNode();
@@ -44,9 +53,9 @@ private:
 	void Initialize();
 };
 
-#define TRIM_MAX_NODE 4
-#define TRIM_MAX_WORD 640
-
+// Node storage and the EEPROM readout buffer are sized from the device header
+// (num_channels, num_pages and the page count the device streams) rather than
+// for the largest device, so a one-channel device keeps one node.
 
 class CTrimReader {
 
@@ -54,14 +63,17 @@ protected:
 
 	CFile InFile;
 
-	CString WordBuf[TRIM_MAX_WORD];
-	int WordIndex;
-	int MaxWord;
-	CString CurWord;
+	// Trim file text, read once and tokenized in place: the current word is
+	// m_WordLen characters at m_Word, inside m_Text.
+
+	std::vector<char> m_Text;			// NUL terminated
+	size_t	m_Pos;
+	const char *m_Word;
+	size_t	m_WordLen;
 
 	// from DPReader
 
-	BYTE	trim_buff[1024];
+	std::vector<BYTE> trim_buff;		// Header pages, num_pages * EPKT_SZ bytes
 	int		tbuff_size;
 	int		tbuff_rptr;
 
@@ -73,9 +85,25 @@ protected:
 	
 	BYTE	num_pages;						// number of EPKT_SZ byte pages needed		
 
+	// EEPROM readout state, see OnEEPROMRead. ee_buff is allocated once the
+	// device reports its page count: ee_npages pages of EPKT_SZ + 1 bytes,
+	// followed by one flag per page set when it was received with good parity.
+
+	std::vector<BYTE> ee_buff;
+	int		ee_npages;						// Pages the device streams, 0 until known
+	int		ee_needed;						// Pages the calibration uses, 0 until the header page is in
+	int		ee_start;						// First page of the current stream
+	int		ee_count;						// Reports received in the current stream
+	int		ee_errors;						// Reports rejected
+
+	BYTE	*EEPage(int i) { return &ee_buff[i * (EPKT_SZ + 1)]; }
+	BYTE	&EEValid(int i) { return ee_buff[ee_npages * (EPKT_SZ + 1) + i]; }
+
+	static const CTrimNode DefaultNode;
+
 public:
 
-	CTrimNode Node[TRIM_MAX_NODE];
+	std::vector<CTrimNode> Node;		// NumNode nodes, one per channel
 	CTrimNode *curNode;
 	int NumNode;
 
@@ -88,12 +116,17 @@ public:
 	void Parse();
 	void ParseNode();
 
-	int GetNumNode() {
+	int GetNumNode() const {
 		return NumNode;
 	}
 
+	void SetNumNode(int n);				// Keeps the first n nodes, new ones get default trim
+
+	// Node k, or the default trim for a channel the calibration does not cover
+	const CTrimNode &GetNode(int k) const { return k >= 0 && k < NumNode ? Node[k] : DefaultNode; }
+
 	int ADCCorrection(int NumData, BYTE HighByte, BYTE LowByte,  int pixelNum, int PCRNum, int gain_mode, int *flag);
-	int ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pixelNum, int PCRNum, int gain_mode, int *flag);
+	int ADCCorrectioni(int NumData, BYTE HighByte, BYTE LowByte, int pixelNum, int PCRNum, int gain_mode, int *flag) const;
 
 
 	void SetV20(BYTE v20);
@@ -102,7 +135,14 @@ public:
 	void Capture12();
 	void Capture12(BYTE);
 	void Capture24();
-	int  ProcessRowData(int (*adc_data)[24], int gain_mode);
+	int  ProcessRowData(int (*adc_data)[24], int gain_mode) const;
+	int  ProcessRowData(int (*adc_data)[24], int gain_mode, const int *dark) const;
+	int  CorrectRow(const BYTE *rx, int chan, int gain_mode, int *frame, int stride, const int *dark = NULL) const;
+	template <typename T> int CorrectRowT(const BYTE *rx, int chan, int gain_mode, T *frame, int dim, int stride, const int *dark, BYTE *flags = NULL) const;		// T: int or uint16_t
+	int  CorrectRowDiff(const BYTE *rx, int chan, int gain_mode, int *frame, int stride) const;
+
+	static int ReportCols(const BYTE *rx) { return rx[4] == 0x08 ? 24 : 12; }		// Row length of a capture report
+	static bool IsLEDAck(const BYTE *rx) { return rx[2] == 0x01 && rx[4] == 0x23; }	// Acknowledge of SetLEDConfig
 
 	void SetRangeTrim(BYTE range);
 	void SetRampgen(BYTE rampgen);
@@ -112,9 +152,19 @@ public:
 	void SetIntTime(float kfl, BYTE ch);
 	void SetLEDConfig(BOOL IndvEn, BOOL Chan1, BOOL Chan2, BOOL Chan3, BOOL Chan4);
 
-	void EEPROMRead();
-	void OnEEPROMRead();
-	void ReadTrimData();
+	void BeginEEPROMRead();
+	void EEPROMRead(BYTE start = 0);		// Device streams pages start .. npages - 1
+	int  OnEEPROMRead();					// 0 at the end of the stream
+	int  EEPROMMissingPage();				// First needed page not yet valid, -1 when complete
+	int  GetEEPROMErrors() { return ee_errors; }
+	int  ReadTrimData();
+	int  ReadTrimData(const BYTE (*eeprom)[EPKT_SZ + 1], int eeprom_pages);
+
+	// ReadTrimData only copies each node's pages; decoding them is left to
+	// first use of the channel. Node k must be restored before it is read.
+	void RestoreNode(int k);
+	void RestoreNodes();
+	bool IsNodePending(int k) { return k >= 0 && k < NumNode && Node[k].pending; }
 
 	// from DPReader
 
@@ -131,9 +181,14 @@ public:
 	BYTE TrimBuff2Byte(int i);
 	void RestoreTrimBuff(int k);
 	void CopyEepromBuff(int k, int index_start);
+	void CopyEepromBuff(int k, int index_start, const BYTE (*eeprom)[EPKT_SZ + 1]);
 
 	void Convert2Int(int c);
 
+	// Compiled calibration files (CalibFile.h), 1: success
+	int  SaveCalib(const char *path);
+	int  LoadCalib(const char *path);
+
 
 protected:
 
@@ -145,8 +200,9 @@ protected:
 
 private:
 
-	int GetWord();
-	int Match(CString);
+	int GetWord();						// 0 at the end of the text
+	int Match(const char *);
+	double WordToDouble();
 };
 
 
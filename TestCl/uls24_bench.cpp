@@ -0,0 +1,304 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// uls24_bench: microbenchmarks of the correction and trim code plus time to
+// first frame and end-to-end capture throughput and latency against a simulated
+// device (SimDevice.h).
+// Results are written as one JSON document so releases can be compared:
+//
+//   {"suite": "uls24_bench", "version": 1, "results": [
+//     {"name": ..., "unit": ..., "value": ..., "iterations": ..., ...}, ...]}
+//
+// Each microbenchmark is run several times and the fastest run is reported,
+// which is the least disturbed by other load on the machine.
+
+#include "stdafx.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "InterfaceWrapper.h"
+#include "MonoClock.h"
+#include "SimDevice.h"
+#include "TrimReader.h"
+
+extern BYTE RxData[];
+
+#define BENCH_RUNS 5
+
+static std::vector<std::string> g_Results;
+static volatile int g_Sink;
+
+static void Result(const char* name, const char* unit, double value, uint64_t iterations, const char* extra = "") {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.4f, \"iterations\": %llu%s}",
+             name, unit, value, (unsigned long long)iterations, extra);
+    g_Results.push_back(buf);
+
+    fprintf(stderr, "%-28s %12.4f %s\n", name, value, unit);
+}
+
+// Fastest of BENCH_RUNS runs of fn, in ns per call of fn
+template <typename F>
+static double Best(F fn) {
+    double best = 0;
+
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        uint64_t t0 = MonoTimeNs();
+        fn();
+        double t = (double)(MonoTimeNs() - t0);
+        if (!r || t < best) {
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+static void BenchADCCorrection(CTrimReader& reader, int iters) {
+    std::vector<BYTE> hb(4096), lb(4096);
+    uint32_t x = 1;
+
+    for (int i = 0; i < 4096; i++) {
+        x = x * 1103515245 + 12345;
+        int v = (x >> 16) & 0xffff;
+        hb[i] = (BYTE)(v >> 8);
+        lb[i] = (BYTE)v;
+    }
+
+    double ns = Best([&]() {
+        int flag, sum = 0;
+        for (int k = 0; k < iters; k++) {
+            sum += reader.ADCCorrectioni(k % 12, hb[k & 4095], lb[k & 4095], 12, 1, 1, &flag);
+        }
+        g_Sink = sum;
+    });
+
+    Result("adc_correctioni", "ns/pixel", ns / iters, iters);
+}
+
+static void BenchProcessRowData(CTrimReader& reader, CSimDevice& sim, int cols, int iters) {
+    const int rows = cols;
+    std::vector<BYTE> reports(rows * RxNum);
+    int frame[24][24];
+
+    for (int r = 0; r < rows; r++) {
+        sim.MakeRow(&reports[r * RxNum], cols == 24 ? 0x08 : 0x02, r, cols);
+    }
+
+    double ns = Best([&]() {
+        for (int k = 0; k < iters; k++) {
+            memcpy(RxData, &reports[(k % rows) * RxNum], RxNum);
+            reader.ProcessRowData(frame, 1);
+        }
+        g_Sink = frame[0][0];
+    });
+
+    Result(cols == 24 ? "process_row_data_24" : "process_row_data_12", "ns/pixel", ns / ((double)iters * cols), iters);
+}
+
+static void BenchTrimParse(const char* trim_path, int iters) {
+    double ns = Best([&]() {
+        for (int k = 0; k < iters; k++) {
+            CTrimReader* reader = new CTrimReader;
+            reader->Load((TCHAR*)trim_path);
+            reader->Parse();
+            g_Sink = reader->GetNumNode();
+            delete reader;
+        }
+    });
+
+    Result("trim_load_parse", "us", ns / iters / 1000, iters);
+}
+
+static void BenchEepromRestore(CTrimReader& reader, CSimDevice& sim, int iters) {
+    double ns = Best([&]() {
+        for (int k = 0; k < iters; k++) {
+            reader.CopyEepromBuff(0, 1, sim.GetEeprom());
+            reader.RestoreTrimBuff(0);
+        }
+        g_Sink = reader.Node[0].kbi[0][0];
+    });
+
+    Result("restore_trim_buff", "us/channel", ns / iters / 1000, iters);
+
+    ns = Best([&]() {
+        for (int k = 0; k < iters; k++) {
+            g_Sink = reader.ReadTrimData(sim.GetEeprom(), sim.GetEepromPages());
+        }
+    });
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), ", \"pages\": %d", sim.GetEepromPages());
+    Result("read_trim_data", "us", ns / iters / 1000, iters, extra);
+}
+
+static void BenchCalibLoad(CTrimReader& reader, int iters) {
+    char path[] = "/tmp/uls24_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+
+    if (reader.SaveCalib(path)) {
+        CTrimReader* dst = new CTrimReader;
+
+        double ns = Best([&]() {
+            for (int k = 0; k < iters; k++) {
+                g_Sink = dst->LoadCalib(path);
+            }
+        });
+
+        Result("calib_file_load", "us", ns / iters / 1000, iters);
+        delete dst;
+    }
+
+    unlink(path);
+}
+
+// Capture frames through the C interface. In real-time mode the simulated
+// device takes int_time plus one report interval per row, so whatever is
+// above that model is host overhead.
+
+static int BenchCapture(CSimDevice& sim, bool realtime, int int_time_ms, int frames) {
+    sim.SetTiming(realtime, SIM_REPORT_US);
+
+    if (!ULS24_SetIntegrationTime(int_time_ms) || !ULS24_CaptureFrame(1)) {     // Warm up
+        fprintf(stderr, "Simulated capture failed\n");
+        return 0;
+    }
+
+    std::vector<double> lat(frames);
+    uint64_t reports = sim.GetReports();
+    uint64_t t0 = MonoTimeNs();
+
+    for (int k = 0; k < frames; k++) {
+        uint64_t t = MonoTimeNs();
+        if (!ULS24_CaptureFrame(1 + k % 4)) {
+            fprintf(stderr, "Simulated capture failed\n");
+            return 0;
+        }
+        lat[k] = (MonoTimeNs() - t) / 1e3;
+    }
+
+    double total_s = (MonoTimeNs() - t0) / 1e9;
+    reports = sim.GetReports() - reports;
+
+    std::sort(lat.begin(), lat.end());
+
+    double p50 = lat[frames / 2];
+    double p99 = lat[std::min(frames - 1, frames * 99 / 100)];
+    double model = realtime ? int_time_ms * 1e3 + 12.0 * SIM_REPORT_US : 0;
+
+    char extra[256];
+    snprintf(extra, sizeof(extra), ", \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"model_us\": %.1f, "
+             "\"overhead_us\": %.1f, \"reports_per_frame\": %.2f",
+             p50, p99, lat[frames - 1], model, p50 - model, (double)reports / frames);
+
+    Result(realtime ? "capture12_realtime" : "capture12_fast", "frames/s", frames / total_s, frames, extra);
+
+    return 1;
+}
+
+// Time from ULS24_Initialize to the first corrected frame of one channel, with
+// real-time device timing. Covers the EEPROM readout and channel programming.
+
+static int BenchFirstFrame(CSimDevice& sim, int chan) {
+    sim.SetTiming(true, SIM_REPORT_US);
+
+    uint64_t commands = sim.GetCommands();
+    uint64_t t0 = MonoTimeNs();
+
+    if (!ULS24_Initialize() || !ULS24_CaptureFrame(chan)) {
+        fprintf(stderr, "Simulated device did not initialize\n");
+        return 0;
+    }
+
+    double ms = (MonoTimeNs() - t0) / 1e6;
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), ", \"commands\": %llu", (unsigned long long)(sim.GetCommands() - commands));
+    Result("first_frame12", "ms", ms, 1, extra);
+
+    return 1;
+}
+
+static void Usage() {
+    fprintf(stderr, "usage: uls24_bench [-t trim.dat] [-o results.json] [-q]\n"
+                    "  -t  trim file for the simulated EEPROM (default TestCl/Trim/trim.dat)\n"
+                    "  -o  write JSON here instead of stdout\n"
+                    "  -q  quick run with fewer iterations\n");
+}
+
+int main(int argc, char** argv) {
+    const char* trim_path = "TestCl/Trim/trim.dat";
+    const char* out_path = NULL;
+    int scale = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:o:qh")) != -1) {
+        switch (opt) {
+        case 't': trim_path = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'q': scale = 1; break;
+        default: Usage(); return 2;
+        }
+    }
+
+    CSimDevice sim;
+    if (!sim.LoadTrim(trim_path)) {
+        fprintf(stderr, "Cannot load trim file %s\n", trim_path);
+        return 1;
+    }
+
+    CTrimReader* reader = new CTrimReader;          // Too big for the stack
+    reader->ReadTrimData(sim.GetEeprom(), sim.GetEepromPages());
+    reader->RestoreNodes();
+
+    BenchADCCorrection(*reader, 100000 * scale);
+    BenchProcessRowData(*reader, sim, 12, 10000 * scale);
+    BenchProcessRowData(*reader, sim, 24, 10000 * scale);
+    BenchTrimParse(trim_path, 20 * scale);
+    BenchEepromRestore(*reader, sim, 1000 * scale);
+    BenchCalibLoad(*reader, 100 * scale);
+
+    delete reader;
+
+    sim.Attach();
+
+    int ok = BenchFirstFrame(sim, 3) && BenchCapture(sim, false, 10, 200 * scale) &&
+             BenchCapture(sim, true, 10, 5 * scale);
+
+    ULS24_Cleanup();
+    sim.Detach();
+
+    FILE* f = out_path ? fopen(out_path, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Cannot create %s\n", out_path);
+        return 1;
+    }
+
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+
+    fprintf(f, "{\n  \"suite\": \"uls24_bench\",\n  \"version\": 1,\n  \"host\": \"%s\",\n  \"complete\": %s,\n  \"results\": [\n",
+            host, ok ? "true" : "false");
+    for (size_t i = 0; i < g_Results.size(); i++) {
+        fprintf(f, "%s%s\n", g_Results[i].c_str(), i + 1 < g_Results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (out_path) {
+        fclose(f);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""
+Reader for the ULS24 shared-memory frame ring (see ShmReader.h).
+The capturing process calls ULS24_PublishStart(); any number of processes can
+then follow its frames with this module. Needs libuls24shm.so (make shmreader),
+not the device or hidapi.
+"""
+import ctypes
+import os
+import sys
+import time
+
+SHM_DEFAULT = "/uls24_frames"
+SHM_PIXELS = 24 * 24
+
+
+class FrameMeta(ctypes.Structure):
+    """Mirror of ULS24_FrameMeta"""
+    _fields_ = [
+        ("seq", ctypes.c_uint64),
+        ("t_start_ns", ctypes.c_uint64),
+        ("t_end_ns", ctypes.c_uint64),
+        ("channel", ctypes.c_int),
+        ("gain", ctypes.c_int),
+        ("int_time_ms", ctypes.c_float),
+        ("size", ctypes.c_int),
+        ("flags", ctypes.c_int),
+        ("calib", ctypes.c_uint32),
+    ]
+
+
+def _load_library(path=None):
+    if path is None:
+        here = os.path.dirname(os.path.abspath(__file__))
+        path = "libuls24shm.so"             # Falls back to the loader search path
+        for candidate in (os.path.join(here, "..", path), os.path.join(here, path)):
+            if os.path.exists(candidate):
+                path = candidate
+                break
+
+    lib = ctypes.CDLL(path)
+
+    lib.ULS24_ShmOpen.restype = ctypes.c_void_p
+    lib.ULS24_ShmOpen.argtypes = [ctypes.c_char_p]
+    lib.ULS24_ShmClose.argtypes = [ctypes.c_void_p]
+    lib.ULS24_ShmHead.restype = ctypes.c_uint64
+    lib.ULS24_ShmHead.argtypes = [ctypes.c_void_p]
+    lib.ULS24_ShmRead.argtypes = [ctypes.c_void_p, ctypes.c_uint64,
+                                  ctypes.POINTER(FrameMeta), ctypes.c_void_p]
+    lib.ULS24_ShmNext.argtypes = [ctypes.c_void_p, ctypes.POINTER(FrameMeta),
+                                  ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint64)]
+    lib.ULS24_ShmLatest.argtypes = [ctypes.c_void_p, ctypes.POINTER(FrameMeta), ctypes.c_void_p]
+    lib.ULS24_ShmSeek.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+
+    return lib
+
+
+class ShmFrameReader:
+    """Follows the frames published by the capturing process"""
+
+    def __init__(self, name=SHM_DEFAULT, library=None):
+        self._lib = _load_library(library)
+        self._handle = self._lib.ULS24_ShmOpen(name.encode())
+        if not self._handle:
+            raise IOError("Shared frame ring %s not found, is the publisher running?" % name)
+
+        self._buf = (ctypes.c_int * SHM_PIXELS)()
+        self.lost = 0
+
+    def close(self):
+        if self._handle:
+            self._lib.ULS24_ShmClose(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def _frame(self, meta):
+        n = meta.size
+        try:
+            import numpy as np
+            data = np.ctypeslib.as_array(self._buf)[:n * n].reshape(n, n).copy()
+        except ImportError:
+            data = [list(self._buf[r * n:(r + 1) * n]) for r in range(n)]
+        return meta, data
+
+    def head(self):
+        """Sequence number of the next frame to be published"""
+        return self._lib.ULS24_ShmHead(self._handle)
+
+    def read(self, seq):
+        """Frame seq as (meta, data), or None if not available"""
+        meta = FrameMeta()
+        if not self._lib.ULS24_ShmRead(self._handle, seq, ctypes.byref(meta), self._buf):
+            return None
+        return self._frame(meta)
+
+    def latest(self):
+        meta = FrameMeta()
+        if not self._lib.ULS24_ShmLatest(self._handle, ctypes.byref(meta), self._buf):
+            return None
+        return self._frame(meta)
+
+    def seek(self, seq):
+        self._lib.ULS24_ShmSeek(self._handle, seq)
+
+    def next(self, poll_interval=0.001, timeout=None):
+        """Next frame after the previous one, waiting by polling shared memory.
+        Returns None on timeout; raises EOFError when the publisher stops."""
+        meta = FrameMeta()
+        lost = ctypes.c_uint64()
+        deadline = None if timeout is None else time.monotonic() + timeout
+
+        while True:
+            rc = self._lib.ULS24_ShmNext(self._handle, ctypes.byref(meta), self._buf, ctypes.byref(lost))
+            self.lost += lost.value
+            if rc == 1:
+                return self._frame(meta)
+            if rc < 0:
+                raise EOFError("Publisher closed the frame ring")
+            if deadline is not None and time.monotonic() >= deadline:
+                return None
+            time.sleep(poll_interval)
+
+    def __iter__(self):
+        while True:
+            try:
+                yield self.next()
+            except EOFError:
+                return
+
+
+if __name__ == "__main__":
+    name = sys.argv[1] if len(sys.argv) > 1 else SHM_DEFAULT
+    with ShmFrameReader(name) as reader:
+        for meta, data in reader:
+            print("seq %d ch %d %dx%d t_end %d lost %d" %
+                  (meta.seq, meta.channel, meta.size, meta.size, meta.t_end_ns, reader.lost))
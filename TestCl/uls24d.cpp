@@ -0,0 +1,479 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// uls24d: owns the ULS24 device and serves capture requests from local
+// clients over a Unix socket (protocol in DaemonProto.h).
+//
+// One thread runs a poll loop over the listening socket, the clients and the
+// library's async eventfd. Only one capture is handed to the library at a
+// time, so the next one is chosen as late as possible: highest priority, then
+// earliest deadline. Every queued request with the same settings rides along
+// with it.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "DaemonProto.h"
+
+#define MAX_PENDING 256
+#define MAX_CACHED  16
+
+struct Settings {
+    int channel;
+    int size;
+    int gain;
+    float int_time;
+
+    bool operator==(const Settings& s) const {
+        return channel == s.channel && size == s.size && gain == s.gain && int_time == s.int_time;
+    }
+};
+
+struct Pending {
+    int client;                 // Client id, not fd, so a reused fd gets nothing stale
+    uint32_t tag;
+    int priority;
+    Settings key;
+    uint64_t arrival;
+    uint64_t deadline;          // 0: none
+    uint64_t min_start;         // Earliest acceptable capture start
+};
+
+struct Client {
+    int fd;
+    std::string in;
+    std::string out;
+};
+
+struct Cached {
+    Settings key;
+    ULS24_FrameMeta meta;
+    int data[24 * 24];
+};
+
+static volatile sig_atomic_t g_Quit = 0;
+
+static std::map<int, Client> g_Clients;
+static int g_NextClient = 1;
+
+static std::vector<Pending> g_Queue;
+static std::vector<Cached> g_Cache;
+
+static struct {
+    bool active;
+    int id;                     // Async capture request id
+    Settings key;
+    uint64_t t_submit;
+    std::vector<Pending> batch;
+} g_Capture;
+
+static bool g_Applied;          // g_AppliedKey is what the device is set to
+static Settings g_AppliedKey;
+
+static void OnSignal(int) {
+    g_Quit = 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Replies
+/////////////////////////////////////////////////////////////////////////////
+
+static void Flush(Client& c) {
+    while (!c.out.empty()) {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n <= 0) break;          // EAGAIN: POLLOUT will finish it; errors show up on the next read
+        c.out.erase(0, n);
+    }
+}
+
+static void Reply(int client, uint32_t tag, int status, int shared, const ULS24_FrameMeta* meta, const int* data) {
+    std::map<int, Client>::iterator it = g_Clients.find(client);
+    if (it == g_Clients.end()) return;          // Client went away
+
+    ULS24D_Reply r;
+    memset(&r, 0, sizeof(r));
+    r.magic = ULS24D_MAGIC;
+    r.tag = tag;
+    r.status = status;
+    r.shared = shared;
+    if (meta) r.meta = *meta;
+
+    it->second.out.append((const char*)&r, sizeof(r));
+    if (status == ULS24D_OK)
+        it->second.out.append((const char*)data, meta->size * meta->size * sizeof(int));
+
+    Flush(it->second);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Scheduling
+/////////////////////////////////////////////////////////////////////////////
+
+// Strict weak order: priority high first, then deadline (none last), then arrival
+
+static bool Before(const Pending& a, const Pending& b) {
+    if (a.priority != b.priority) return a.priority > b.priority;
+
+    uint64_t da = a.deadline ? a.deadline : UINT64_MAX;
+    uint64_t db = b.deadline ? b.deadline : UINT64_MAX;
+    if (da != db) return da < db;
+
+    return a.arrival < b.arrival;
+}
+
+static Cached* FindCached(const Settings& key) {
+    for (size_t i = 0; i < g_Cache.size(); i++)
+        if (g_Cache[i].key == key) return &g_Cache[i];
+    return NULL;
+}
+
+static void StoreCached(const Settings& key, const ULS24_FrameMeta& meta, const int* data) {
+    Cached* c = FindCached(key);
+
+    if (!c) {
+        if (g_Cache.size() >= MAX_CACHED) g_Cache.erase(g_Cache.begin());
+        g_Cache.push_back(Cached());
+        c = &g_Cache.back();
+        c->key = key;
+    }
+
+    c->meta = meta;
+    memcpy(c->data, data, meta.size * meta.size * sizeof(int));
+}
+
+static void ExpireDeadlines(uint64_t now) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < g_Queue.size(); i++) {
+        if (g_Queue[i].deadline && g_Queue[i].deadline <= now)
+            Reply(g_Queue[i].client, g_Queue[i].tag, ULS24D_ERR_EXPIRED, 0, NULL, NULL);
+        else
+            g_Queue[n++] = g_Queue[i];
+    }
+
+    g_Queue.resize(n);
+}
+
+// Queue the register writes that differ, then the capture. The async worker
+// runs them in order; only the capture id is waited for, PollDevice releases
+// the others as they finish.
+
+static void StartNext() {
+    if (g_Capture.active || g_Queue.empty()) return;
+
+    size_t best = 0;
+    for (size_t i = 1; i < g_Queue.size(); i++)
+        if (Before(g_Queue[i], g_Queue[best])) best = i;
+
+    Settings key = g_Queue[best].key;
+
+    g_Capture.batch.clear();
+    size_t n = 0;
+    for (size_t i = 0; i < g_Queue.size(); i++) {
+        if (g_Queue[i].key == key) g_Capture.batch.push_back(g_Queue[i]);
+        else g_Queue[n++] = g_Queue[i];
+    }
+    g_Queue.resize(n);
+
+    if (!g_Applied || g_AppliedKey.channel != key.channel) {
+        ULS24_SelectChannelAsync(key.channel, NULL, NULL);
+        g_Applied = false;
+    }
+    if (!g_Applied || g_AppliedKey.gain != key.gain)
+        ULS24_SetGainModeAsync(key.gain, NULL, NULL);
+    if (!g_Applied || g_AppliedKey.int_time != key.int_time)
+        ULS24_SetIntegrationTimeAsync(key.int_time, NULL, NULL);
+
+    g_Applied = true;
+    g_AppliedKey = key;
+
+    g_Capture.key = key;
+    g_Capture.t_submit = ULS24_MonotonicNs();
+    g_Capture.id = ULS24_CaptureAsync(key.channel, key.size, NULL, NULL);
+    g_Capture.active = true;
+
+    if (!g_Capture.id) {            // Library shut down
+        for (size_t i = 0; i < g_Capture.batch.size(); i++)
+            Reply(g_Capture.batch[i].client, g_Capture.batch[i].tag, ULS24D_ERR_DEVICE, 0, NULL, NULL);
+        g_Capture.active = false;
+    }
+}
+
+static void FinishCapture() {
+    static int frame[24 * 24];
+    ULS24_FrameMeta meta;
+
+    int status = ULS24_AsyncResult(g_Capture.id, &meta, frame);
+    int shared = (int)g_Capture.batch.size();
+    bool ok = status == ULS24_ASYNC_DONE;
+
+    if (ok) StoreCached(g_Capture.key, meta, frame);
+    else g_Applied = false;         // Reprogram everything once the device is back
+
+    for (size_t i = 0; i < g_Capture.batch.size(); i++) {
+        const Pending& p = g_Capture.batch[i];
+        Reply(p.client, p.tag, ok ? ULS24D_OK : ULS24D_ERR_DEVICE, shared, ok ? &meta : NULL, frame);
+    }
+
+    g_Capture.batch.clear();
+    g_Capture.active = false;
+}
+
+static void PollDevice() {
+    int ids[32];
+    int n;
+
+    do {
+        n = ULS24_AsyncPoll(ids, 32);
+
+        for (int i = 0; i < n; i++) {
+            if (g_Capture.active && ids[i] == g_Capture.id) FinishCapture();
+            else ULS24_AsyncRelease(ids[i]);
+        }
+    } while (n == 32);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Requests
+/////////////////////////////////////////////////////////////////////////////
+
+static void HandleRequest(int client, const ULS24D_Request& req) {
+    if (req.magic != ULS24D_MAGIC || req.op != ULS24D_OP_CAPTURE ||
+        req.channel < 1 || req.channel > 4 || (req.size != 12 && req.size != 24) || req.gain > 1 ||
+        !(req.int_time_ms >= 1 && req.int_time_ms <= 66000)) {
+        Reply(client, req.tag, ULS24D_ERR_ARGS, 0, NULL, NULL);
+        return;
+    }
+
+    uint64_t now = ULS24_MonotonicNs();
+    uint64_t age = (uint64_t)req.max_age_us * 1000;
+
+    Pending p;
+    p.client = client;
+    p.tag = req.tag;
+    p.priority = req.priority;
+    p.key.channel = req.channel;
+    p.key.size = req.size;
+    p.key.gain = req.gain;
+    p.key.int_time = req.int_time_ms;
+    p.arrival = now;
+    p.deadline = req.deadline_us ? now + (uint64_t)req.deadline_us * 1000 : 0;
+    p.min_start = now > age ? now - age : 0;
+
+    // A recent enough frame with these settings is already here
+
+    Cached* c = FindCached(p.key);
+    if (c && c->meta.t_start_ns >= p.min_start) {
+        Reply(client, req.tag, ULS24D_OK, 1, &c->meta, c->data);
+        return;
+    }
+
+    // The capture in progress started late enough
+
+    if (g_Capture.active && g_Capture.key == p.key && g_Capture.t_submit >= p.min_start) {
+        g_Capture.batch.push_back(p);
+        return;
+    }
+
+    if (g_Queue.size() >= MAX_PENDING) {
+        Reply(client, req.tag, ULS24D_ERR_BUSY, 0, NULL, NULL);
+        return;
+    }
+
+    g_Queue.push_back(p);
+}
+
+static void DropClient(int client) {
+    std::map<int, Client>::iterator it = g_Clients.find(client);
+    if (it == g_Clients.end()) return;
+
+    close(it->second.fd);
+    g_Clients.erase(it);
+
+    size_t n = 0;
+    for (size_t i = 0; i < g_Queue.size(); i++)
+        if (g_Queue[i].client != client) g_Queue[n++] = g_Queue[i];
+    g_Queue.resize(n);
+}
+
+static void ReadClient(int client) {
+    Client& c = g_Clients[client];
+    char buf[4096];
+
+    ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        DropClient(client);
+        return;
+    }
+    if (n < 0) return;
+
+    c.in.append(buf, n);
+
+    size_t off = 0;
+    while (c.in.size() - off >= sizeof(ULS24D_Request)) {
+        ULS24D_Request req;
+        memcpy(&req, c.in.data() + off, sizeof(req));
+        off += sizeof(req);
+
+        if (req.magic != ULS24D_MAGIC) {        // Out of sync, nothing sensible to do
+            DropClient(client);
+            return;
+        }
+
+        HandleRequest(client, req);
+    }
+
+    c.in.erase(0, off);
+}
+
+static int Listen(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    return fd;
+}
+
+static int NextTimeout(uint64_t now) {
+    uint64_t first = 0;
+
+    for (size_t i = 0; i < g_Queue.size(); i++)
+        if (g_Queue[i].deadline && (!first || g_Queue[i].deadline < first)) first = g_Queue[i].deadline;
+
+    if (!first) return -1;
+    if (first <= now) return 0;
+
+    return (int)((first - now + 999999) / 1000000);
+}
+
+int main(int argc, char** argv) {
+    const char* path = ULS24D_SOCKET;
+    const char* shm = NULL;
+    bool publish = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:p::h")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'p':
+            publish = true;
+            shm = optarg;
+            break;
+        default:
+            printf("Usage: %s [-s socket] [-p[shm_name]]\n", argv[0]);
+            printf("  -s  Unix socket path (default %s)\n", ULS24D_SOCKET);
+            printf("  -p  Also publish every frame to shared memory (see ShmReader.h)\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!ULS24_Initialize()) {
+        fprintf(stderr, "uls24d: device not found\n");
+        return 1;
+    }
+
+    if (publish && !ULS24_PublishStart(shm, 0))
+        fprintf(stderr, "uls24d: shared-memory publishing failed, continuing without\n");
+
+    int lfd = Listen(path);
+    if (lfd < 0) {
+        perror("uls24d: listen");
+        ULS24_Cleanup();
+        return 1;
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int efd = ULS24_AsyncEventFd();
+    std::vector<struct pollfd> fds;
+    std::vector<int> ids;
+
+    printf("uls24d: listening on %s\n", path);
+
+    while (!g_Quit) {
+        fds.clear();
+        ids.clear();
+
+        struct pollfd pfd;
+        pfd.fd = lfd;
+        pfd.events = POLLIN;
+        fds.push_back(pfd);
+
+        pfd.fd = efd;
+        fds.push_back(pfd);
+
+        for (std::map<int, Client>::iterator it = g_Clients.begin(); it != g_Clients.end(); ++it) {
+            pfd.fd = it->second.fd;
+            pfd.events = POLLIN | (it->second.out.empty() ? 0 : POLLOUT);
+            fds.push_back(pfd);
+            ids.push_back(it->first);
+        }
+
+        int n = poll(&fds[0], fds.size(), NextTimeout(ULS24_MonotonicNs()));
+        if (n < 0 && errno != EINTR) break;
+
+        if (n > 0) {
+            if (fds[1].revents & POLLIN) PollDevice();
+
+            for (size_t i = 0; i < ids.size(); i++) {
+                short ev = fds[i + 2].revents;
+                if (!ev || !g_Clients.count(ids[i])) continue;
+
+                if (ev & POLLOUT) Flush(g_Clients[ids[i]]);
+                if (ev & (POLLIN | POLLHUP | POLLERR)) ReadClient(ids[i]);
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int cfd;
+                while ((cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+                    Client c;
+                    c.fd = cfd;
+                    g_Clients[g_NextClient++] = c;
+                }
+            }
+        }
+
+        ExpireDeadlines(ULS24_MonotonicNs());
+        StartNext();
+    }
+
+    for (std::map<int, Client>::iterator it = g_Clients.begin(); it != g_Clients.end(); ++it)
+        close(it->second.fd);
+
+    close(lfd);
+    unlink(path);
+
+    ULS24_Cleanup();
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Client for uls24d, the capture daemon (see DaemonProto.h).
+Lets several tools share the device without each calling FindTheHID.
+"""
+import socket
+import struct
+import sys
+
+ULS24D_MAGIC = 0x44343255
+ULS24D_SOCKET = "/tmp/uls24d.sock"
+ULS24D_OP_CAPTURE = 1
+
+STATUS_TEXT = {0: "ok", -1: "bad arguments", -2: "device error", -3: "deadline expired", -4: "daemon busy"}
+
+# ULS24D_Request and ULS24D_Reply (native layout, ULS24_FrameMeta is 48 bytes)
+REQUEST = struct.Struct("=IIHBBBbHfII")
+REPLY = struct.Struct("=IIiIQQQiifiiI")
+
+
+class ULS24DaemonClient:
+    """Synchronous client; one outstanding request at a time"""
+
+    def __init__(self, path=ULS24D_SOCKET):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.tag = 0
+
+    def close(self):
+        self.sock.close()
+
+    def _recv(self, n):
+        buf = b""
+        while len(buf) < n:
+            chunk = self.sock.recv(n - len(buf))
+            if not chunk:
+                raise IOError("uls24d closed the connection")
+            buf += chunk
+        return buf
+
+    def capture(self, channel, size=12, gain=1, int_time_ms=30.0,
+                priority=0, deadline_us=0, max_age_us=0):
+        """Returns (meta dict, rows). Raises IOError if the daemon reports an error."""
+        self.tag += 1
+        self.sock.sendall(REQUEST.pack(ULS24D_MAGIC, self.tag, ULS24D_OP_CAPTURE, channel, size,
+                                       gain, priority, 0, int_time_ms, deadline_us, max_age_us))
+
+        (magic, tag, status, shared, seq, t_start, t_end, chan, g, it, n, flags, calib) = \
+            REPLY.unpack(self._recv(REPLY.size))
+
+        if magic != ULS24D_MAGIC or tag != self.tag:
+            raise IOError("Unexpected reply from uls24d")
+        if status != 0:
+            raise IOError("uls24d: " + STATUS_TEXT.get(status, str(status)))
+
+        pixels = struct.unpack("=%di" % (n * n), self._recv(4 * n * n))
+        rows = [list(pixels[r * n:(r + 1) * n]) for r in range(n)]
+        meta = {"seq": seq, "t_start_ns": t_start, "t_end_ns": t_end, "channel": chan,
+                "gain": g, "int_time_ms": it, "size": n, "flags": flags, "calib": calib,
+                "shared": shared}
+
+        return meta, rows
+
+
+if __name__ == "__main__":
+    channel = int(sys.argv[1]) if len(sys.argv) > 1 else 1
+    client = ULS24DaemonClient()
+    meta, rows = client.capture(channel)
+    print(meta)
+    for row in rows:
+        print(" ".join("%5d" % v for v in row))
+    client.close()
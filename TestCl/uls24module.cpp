@@ -0,0 +1,354 @@
+// Copyright 2014-2017, Anitoa Systems, LLC
+// All rights reserved
+
+// Native Python module over the ULS24 C interface (ULSLIB.so).
+//
+// Frames are returned as uls24native.Frame objects that own their pixels and
+// export them through the buffer protocol, so numpy.asarray(frame) is a
+// zero-copy (size, size) int32 view. Captures correct pixels directly into the
+// Frame's storage and run with the GIL released.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include "InterfaceWrapper.h"
+
+#define FRAME_MAX_PIXELS (24 * 24)
+
+/////////////////////////////////////////////////////////////////////////////
+// Frame
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	PyObject_HEAD
+	ULS24_FrameMeta meta;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+	int data[FRAME_MAX_PIXELS];
+} FrameObject;
+
+// Type objects are filled in by PyInit_uls24native
+static PyTypeObject FrameType;
+
+static void InitTypeHead(PyTypeObject *type)
+{
+	PyVarObject head = { PyObject_HEAD_INIT(NULL) 0 };
+	type->ob_base = head;
+}
+
+static FrameObject *Frame_New(int size)
+{
+	FrameObject *f = PyObject_New(FrameObject, &FrameType);
+	if (!f)
+		return NULL;
+
+	memset(&f->meta, 0, sizeof(f->meta));
+	f->meta.size = size;
+	f->shape[0] = f->shape[1] = size;
+	f->strides[0] = size * sizeof(int);
+	f->strides[1] = sizeof(int);
+
+	return f;
+}
+
+static int Frame_GetBuffer(PyObject *obj, Py_buffer *view, int flags)
+{
+	FrameObject *f = (FrameObject *)obj;
+	int size = f->meta.size;
+
+	view->obj = obj;
+	view->buf = f->data;
+	view->len = size * size * sizeof(int);
+	view->readonly = 0;
+	view->itemsize = sizeof(int);
+	view->format = (flags & PyBUF_FORMAT) ? (char *)"i" : NULL;
+	view->ndim = (flags & PyBUF_ND) ? 2 : 1;			// Without PyBUF_ND: unstructured bytes, no shape
+	view->shape = (flags & PyBUF_ND) ? f->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? f->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+
+	Py_INCREF(obj);
+
+	return 0;
+}
+
+static PyBufferProcs Frame_BufferProcs = {
+	Frame_GetBuffer,
+	NULL,
+};
+
+static PyObject *Frame_ToList(PyObject *obj, PyObject *)
+{
+	FrameObject *f = (FrameObject *)obj;
+	int size = f->meta.size;
+
+	PyObject *rows = PyList_New(size);
+	if (!rows)
+		return NULL;
+
+	for (int i = 0; i < size; i++) {
+		PyObject *row = PyList_New(size);
+		if (!row) {
+			Py_DECREF(rows);
+			return NULL;
+		}
+		for (int j = 0; j < size; j++)
+			PyList_SET_ITEM(row, j, PyLong_FromLong(f->data[i * size + j]));
+		PyList_SET_ITEM(rows, i, row);
+	}
+
+	return rows;
+}
+
+static PyObject *Frame_Repr(PyObject *obj)
+{
+	FrameObject *f = (FrameObject *)obj;
+
+	return PyUnicode_FromFormat("<uls24native.Frame %dx%d channel=%d seq=%llu>",
+		f->meta.size, f->meta.size, f->meta.channel, (unsigned long long)f->meta.seq);
+}
+
+static PyMethodDef Frame_Methods[] = {
+	{ "tolist", Frame_ToList, METH_NOARGS, "Pixels as nested lists (copies)." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyMemberDef Frame_Members[] = {
+	{ (char *)"seq", T_ULONGLONG, offsetof(FrameObject, meta.seq), READONLY, NULL },
+	{ (char *)"t_start_ns", T_ULONGLONG, offsetof(FrameObject, meta.t_start_ns), READONLY, (char *)"Capture command sent, CLOCK_MONOTONIC" },
+	{ (char *)"t_end_ns", T_ULONGLONG, offsetof(FrameObject, meta.t_end_ns), READONLY, (char *)"Last row received" },
+	{ (char *)"channel", T_INT, offsetof(FrameObject, meta.channel), READONLY, NULL },
+	{ (char *)"gain", T_INT, offsetof(FrameObject, meta.gain), READONLY, NULL },
+	{ (char *)"int_time", T_FLOAT, offsetof(FrameObject, meta.int_time_ms), READONLY, (char *)"Integration time in ms" },
+	{ (char *)"size", T_INT, offsetof(FrameObject, meta.size), READONLY, NULL },
+	{ (char *)"flags", T_INT, offsetof(FrameObject, meta.flags), READONLY, NULL },
+	{ (char *)"calib", T_UINT, offsetof(FrameObject, meta.calib), READONLY, (char *)"Calibration version used for correction" },
+	{ NULL, 0, 0, 0, NULL }
+};
+
+// Capture one frame into a new Frame with the GIL released. Returns NULL with
+// an exception set on failure.
+
+static FrameObject *CaptureFrame(int channel, int size)
+{
+	FrameObject *f = Frame_New(size);
+	if (!f)
+		return NULL;
+
+	int ok;
+	Py_BEGIN_ALLOW_THREADS
+	ok = ULS24_CaptureFrameInto(channel, size, f->data, &f->meta);
+	Py_END_ALLOW_THREADS
+
+	if (!ok) {
+		Py_DECREF(f);
+		PyErr_SetString(PyExc_IOError, "capture failed");
+		return NULL;
+	}
+
+	return f;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Stream iterator
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	PyObject_HEAD
+	int channel;
+	int size;
+	long remaining;		// < 0: endless
+} StreamObject;
+
+static PyObject *Stream_Next(PyObject *obj)
+{
+	StreamObject *s = (StreamObject *)obj;
+
+	if (!s->remaining)
+		return NULL;		// StopIteration
+
+	FrameObject *f = CaptureFrame(s->channel, s->size);
+	if (f && s->remaining > 0)
+		s->remaining--;
+
+	return (PyObject *)f;
+}
+
+static PyTypeObject StreamType;
+
+/////////////////////////////////////////////////////////////////////////////
+// Module functions
+/////////////////////////////////////////////////////////////////////////////
+
+static PyObject *uls24_initialize(PyObject *, PyObject *)
+{
+	int ok;
+	Py_BEGIN_ALLOW_THREADS
+	ok = ULS24_Initialize();
+	Py_END_ALLOW_THREADS
+
+	return PyBool_FromLong(ok);
+}
+
+static PyObject *uls24_cleanup(PyObject *, PyObject *)
+{
+	Py_BEGIN_ALLOW_THREADS
+	ULS24_Cleanup();
+	Py_END_ALLOW_THREADS
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CheckResult(int ok, const char *what)
+{
+	if (!ok) {
+		PyErr_SetString(PyExc_ValueError, what);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *uls24_select_channel(PyObject *, PyObject *args)
+{
+	int channel, ok;
+	if (!PyArg_ParseTuple(args, "i", &channel))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = ULS24_SelectChannel(channel);
+	Py_END_ALLOW_THREADS
+
+	return CheckResult(ok, "channel must be 1-4 and the device initialized");
+}
+
+static PyObject *uls24_set_integration_time(PyObject *, PyObject *args)
+{
+	int ms, ok;
+	if (!PyArg_ParseTuple(args, "i", &ms))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = ULS24_SetIntegrationTime(ms);
+	Py_END_ALLOW_THREADS
+
+	return CheckResult(ok, "integration time must be 1-66000 ms and the device initialized");
+}
+
+static PyObject *uls24_set_gain_mode(PyObject *, PyObject *args)
+{
+	int gain, ok;
+	if (!PyArg_ParseTuple(args, "i", &gain))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = ULS24_SetGainMode(gain);
+	Py_END_ALLOW_THREADS
+
+	return CheckResult(ok, "gain must be 0 (high) or 1 (low) and the device initialized");
+}
+
+static PyObject *uls24_capture(PyObject *, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = { "channel", "size", NULL };
+	int channel, size = 12;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|i", (char **)kwlist, &channel, &size))
+		return NULL;
+
+	if (size != 12 && size != 24) {
+		PyErr_SetString(PyExc_ValueError, "size must be 12 or 24");
+		return NULL;
+	}
+
+	return (PyObject *)CaptureFrame(channel, size);
+}
+
+static PyObject *uls24_stream(PyObject *, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = { "channel", "count", "size", NULL };
+	int channel, size = 12;
+	long count = -1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|li", (char **)kwlist, &channel, &count, &size))
+		return NULL;
+
+	if (size != 12 && size != 24) {
+		PyErr_SetString(PyExc_ValueError, "size must be 12 or 24");
+		return NULL;
+	}
+
+	StreamObject *s = PyObject_New(StreamObject, &StreamType);
+	if (!s)
+		return NULL;
+
+	s->channel = channel;
+	s->size = size;
+	s->remaining = count;
+
+	return (PyObject *)s;
+}
+
+static PyMethodDef ModuleMethods[] = {
+	{ "initialize", uls24_initialize, METH_NOARGS, "Find the device and load its calibration. Returns True if found." },
+	{ "cleanup", uls24_cleanup, METH_NOARGS, "Release the device." },
+	{ "select_channel", uls24_select_channel, METH_VARARGS, "select_channel(channel): 1-4" },
+	{ "set_integration_time", uls24_set_integration_time, METH_VARARGS, "set_integration_time(ms): 1-66000" },
+	{ "set_gain_mode", uls24_set_gain_mode, METH_VARARGS, "set_gain_mode(gain): 0 high, 1 low" },
+	{ "capture", (PyCFunction)(void (*)(void))uls24_capture, METH_VARARGS | METH_KEYWORDS,
+		"capture(channel, size=12) -> Frame. Runs without the GIL." },
+	{ "stream", (PyCFunction)(void (*)(void))uls24_stream, METH_VARARGS | METH_KEYWORDS,
+		"stream(channel, count=-1, size=12) -> iterator of Frame, endless if count < 0." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef ModuleDef = {
+	PyModuleDef_HEAD_INIT,
+	"uls24native",
+	"Native ULS24 interface with zero-copy frames.",
+	-1,
+	ModuleMethods,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+PyMODINIT_FUNC PyInit_uls24native(void)
+{
+	InitTypeHead(&FrameType);
+	FrameType.tp_name = "uls24native.Frame";
+	FrameType.tp_basicsize = sizeof(FrameObject);
+	FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+	FrameType.tp_doc = "Corrected frame, exports a (size, size) int32 buffer.";
+	FrameType.tp_as_buffer = &Frame_BufferProcs;
+	FrameType.tp_methods = Frame_Methods;
+	FrameType.tp_members = Frame_Members;
+	FrameType.tp_repr = Frame_Repr;
+
+	InitTypeHead(&StreamType);
+	StreamType.tp_name = "uls24native.Stream";
+	StreamType.tp_basicsize = sizeof(StreamObject);
+	StreamType.tp_flags = Py_TPFLAGS_DEFAULT;
+	StreamType.tp_doc = "Iterator returned by stream().";
+	StreamType.tp_iter = PyObject_SelfIter;
+	StreamType.tp_iternext = Stream_Next;
+
+	if (PyType_Ready(&FrameType) < 0 || PyType_Ready(&StreamType) < 0)
+		return NULL;
+
+	PyObject *m = PyModule_Create(&ModuleDef);
+	if (!m)
+		return NULL;
+
+	Py_INCREF(&FrameType);
+	if (PyModule_AddObject(m, "Frame", (PyObject *)&FrameType) < 0) {
+		Py_DECREF(&FrameType);
+		Py_DECREF(m);
+		return NULL;
+	}
+
+	return m;
+}